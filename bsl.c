@@ -11,166 +11,75 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <linux/i2c.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-#include <sys/select.h>
-
 #include "bsl.h"
+#include "capture.h"
 #include "common.h"
+#include "crc32.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "transport.h"
 
 extern int verbosity;
 
+#ifdef DEBUG_FRAMES
 static void dump_data(char *prefix, uint8_t *buf, int len)
 {
+	char line[16 * 5 + 1];
+
 	if (!verbosity) {
 		return;
 	}
 
-	printf("%s\n", prefix);
-	for (int i=0; i<len; i++) {
-		printf("0x%02x ", buf[i]);
-		if ((i+1)%16 == 0) {
-			printf("\n");
+	log_printf("%s\n", prefix);
+	for (int i=0; i<len; i+=16) {
+		int n = 0;
+
+		for (int j=i; j<len && j<i+16; j++) {
+			n += sprintf(line + n, "0x%02x ", buf[j]);
 		}
+		log_printf("%s\n", line);
 	}
-	printf("\n");
 }
+#else
+/* release builds only keep the frames in the trace ring */
+#define dump_data(prefix, buf, len) do { } while (0)
+#endif
 
-static int i2c_write_read(int fd, uint8_t addr, uint8_t *tx, uint32_t write_len,
-		uint8_t *rx, uint32_t read_len)
+/*
+ * Number of bytes still missing to complete the response in buf. The
+ * acknowledgement comes first, a core response follows only on success:
+ *
+ *   ACK | 0x08 | LEN (2) | core response (LEN) | CRC (4)
+ */
+uint32_t bsl_response_missing(uint8_t *buf, uint32_t len, bool core)
 {
-	struct i2c_msg message;
-	struct i2c_rdwr_ioctl_data packets;
+	uint32_t total;
 
-	if (ioctl(fd, I2C_SLAVE, addr) < 0) {
-		int error_code = errno;
-		printf("ioctl(I2C_SLAVE) failed and returned errno %s \n",
-				strerror(error_code));
-	}
-
-	memset(&message, 0, sizeof(message));
-	memset(&packets, 0, sizeof(packets));
-
-	/* setup write message */
-	message.addr = addr;
-	message.flags = 0;
-	message.len = write_len;
-	message.buf = tx;
-
-	packets.msgs = &message;
-	packets.nmsgs = 1;
-
-	if (ioctl(fd, I2C_RDWR, &packets) < 0) {
-		int error_code = errno;
-		printf("%s: ioctl(I2C_RDWR) write failed and returned errno %s \n",
-				__func__, strerror(error_code));
+	if (len < 1) {
 		return 1;
 	}
 
-	memset(&message, 0, sizeof(message));
-	memset(&packets, 0, sizeof(packets));
-
-	/* setup read message */
-	message.addr = addr;
-	message.flags = I2C_M_RD;
-	message.len = read_len;
-	message.buf = rx;
-
-	packets.msgs = &message;
-	packets.nmsgs = 1;
-
-	if (ioctl(fd, I2C_RDWR, &packets) < 0) {
-		int error_code = errno;
-		printf("%s: ioctl(I2C_RDWR) read failed and returned errno %s \n",
-				__func__, strerror(error_code));
-		return 1;
+	if (buf[0] != BSL_ACK || !core) {
+		return 0;
 	}
 
-	return 0;
-}
-
-static int uart_write_read(int fd, uint8_t *tx, uint32_t write_len,
-		uint8_t *rx, uint32_t read_len)
-{
-	struct timeval tv;
-	int rc;
-	uint32_t idx = 0;
-	int cnt;
-	fd_set fds;
-	long timeout_ms = 500;
-
-	rc = write(fd, tx, write_len);
-	assert(rc != -1);
-
-	while (idx < read_len) {
-		int n;
-		FD_ZERO(&fds);
-		FD_SET(fd, &fds);
-
-		tv.tv_sec = timeout_ms / 1000;
-		tv.tv_usec = (timeout_ms % 1000) * 1000;
-
-		n = select(fd+1, &fds, NULL, NULL, &tv);
-		assert(n >= -1 && n <= 1);
-
-		if (n == -1) {
-			perror("select() failed");
-			return 1;
-		} else if (n == 0) {
-			/* timeout */
-			DEBUG(0, "timeout\n");
-			return EIO;
-		} else if (n == 1) {
-			cnt = read(fd, rx + idx, read_len - idx);
-			assert(cnt > 0);
-			idx += cnt;
-			DEBUG(2, "received %d bytes\n", cnt);
-		} else {
-			perror("should not happen");
-			return 1;
-		}
+	if (len < BSL_RSP_HEADER_SIZE) {
+		return BSL_RSP_HEADER_SIZE - len;
 	}
 
-	return 0;
-}
-
-static int bsl_write_read(struct bsl_intf *intf,
-		uint8_t *tx, uint32_t write_len, uint8_t *rx, uint32_t read_len)
-{
-	int rc = -1;
-
-	switch (intf->type) {
-		case INTERFACE_TYPE_I2C:
-			rc = i2c_write_read(intf->fd, intf->i2c_address,
-						tx, write_len, rx, read_len);
-			break;
-		case INTERFACE_TYPE_UART:
-			rc = uart_write_read(intf->fd, tx, write_len, rx, read_len);
-			break;
+	if (buf[1] != BSL_RSP_HEADER) {
+		/* rejected by check_bsl_frame() */
+		return 0;
 	}
 
-	return rc;
-}
-
-#define POLY 0xEDB88320
-uint32_t crc32(uint8_t *buf, int len)
-{
-	uint32_t crc = 0xFFFFFFFF;
-	uint32_t mask;
+	total = BSL_RSP_HEADER_SIZE + (buf[2] | buf[3] << 8) + BSL_CRC_SIZE;
 
-	for (int i=0; i<len; i++) {
-		crc = crc ^ buf[i];
-
-		for (int j=0; j<8; j++) {
-			mask = -(crc & 1);
-			crc = (crc >> 1) ^ (POLY & mask);
-		}
-	}
-	return crc;
+	return total > len ? total - len : 0;
 }
 
 static void add_crc(uint8_t *data, int len)
@@ -197,25 +106,25 @@ static int check_bsl_acknowledgement(uint8_t ack)
 	if (ack != BSL_ACK) {
 		switch (ack) {
 			case BSL_ERROR_HEADER_INCORRECT:
-				printf("BSL_ERROR_HEADER_INCORRECT\n");
+				log_printf("BSL_ERROR_HEADER_INCORRECT\n");
 				break;
 			case BSL_ERROR_CHECKSUM_INCORRECT:
-				printf("BSL_ERROR_CHECKSUM_INCORRECT\n");
+				log_printf("BSL_ERROR_CHECKSUM_INCORRECT\n");
 				break;
 			case BSL_ERROR_PACKET_SIZE_ZERO:
-				printf("BSL_ERROR_PACKET_SIZE_ZERO\n");
+				log_printf("BSL_ERROR_PACKET_SIZE_ZERO\n");
 				break;
 			case BSL_ERROR_PACKET_SIZE_TOO_BIG:
-				printf("BSL_ERROR_PACKET_SIZE_TOO_BIGn\n");
+				log_printf("BSL_ERROR_PACKET_SIZE_TOO_BIG\n");
 				break;
 			case BSL_ERROR_UNKNOWN_ERROR:
-				printf("BSL_ERROR_UNKNOWN_ERROR\n");
+				log_printf("BSL_ERROR_UNKNOWN_ERROR\n");
 				break;
 			case BSL_ERROR_UNKNOWN_BAUD_RATE:
-				printf("BSL_ERROR_UNKNOWN_BAUD_RATE\n");
+				log_printf("BSL_ERROR_UNKNOWN_BAUD_RATE\n");
 				break;
 			default:
-				printf("ERROR: acknowledge 0x%02x\n", ack);
+				log_printf("ERROR: acknowledge 0x%02x\n", ack);
 				break;
 		}
 		return 1;
@@ -235,7 +144,7 @@ static int check_bsl_response(uint8_t *buffer, int len)
 
 	/* BSL Core Message Header */
 	if (buffer[1] != 0x08) {
-		printf("invalid response header\n");
+		log_printf("invalid response header\n");
 		return 1;
 	}
 
@@ -243,40 +152,234 @@ static int check_bsl_response(uint8_t *buffer, int len)
 			&& buffer[5] != BSL_CORE_MSG_OPERATION_SUCCESSFUL) {
 		switch (buffer[5]) {
 			case BSL_CORE_MSG_BSL_LOCKED_ERROR:
-				printf("Incorrect password sent to unlock bootloader\n");
+				log_printf("Incorrect password sent to unlock bootloader\n");
 				return 1;
 			case BSL_CORE_MSG_BSL_PASSWORD_ERROR:
 				return 1;
 			case BSL_CORE_MSG_MULTIPLE_BSL_PASSWORD_ERROR:
 				return 1;
 			case BSL_CORE_MSG_UNKNOWN_COMMAND:
-				printf("Unknown command\n");
+				log_printf("Unknown command\n");
 				return 1;
 			case BSL_CORE_MSG_INVALID_MEMORY_RAMGE:
-				printf("The given memory range is invalid\n");
+				log_printf("The given memory range is invalid\n");
 				return 1;
 			case BSL_CORE_MSG_INVALID_COMMAND:
 				return 1;
 			case BSL_CORE_MSG_FACTORY_RESET_DISABLED:
-				printf("Factory reset is disabled in the BCR configuration\n");
+				log_printf("Factory reset is disabled in the BCR configuration\n");
 				return 1;
 			case BSL_CORE_MSG_FACTORY_RESET_PASSWORD_ERROR:
-				printf("Incorrect/no password sent with factory reset CMD\n");
+				log_printf("Incorrect/no password sent with factory reset CMD\n");
 				return 1;
 			case BSL_CORE_MSG_READ_OUT_ERROR:
-				printf("Read out is disabled in BCR configuration\n");
+				log_printf("Read out is disabled in BCR configuration\n");
 				return 1;
 			case BSL_CORE_MSG_INVALID_ADDRESS:
-				printf("Start address or data length is not 8-byte aligned\n");
+				log_printf("Start address or data length is not 8-byte aligned\n");
 				return 1;
 			case BSL_CORE_MSG_INVALID_LENGTH:
-				printf("Data size is less than 1KB\n");
+				log_printf("Data size is less than 1KB\n");
 				return 1;
 		}
 	}
 	return 0;
 }
 
+static int check_bsl_frame(uint8_t *rx, uint32_t len, bool core)
+{
+	uint32_t core_len;
+	uint32_t crc;
+
+	if (check_bsl_acknowledgement(rx[0])) {
+		/*
+		 * Only a frame damaged on the way was rejected for the link,
+		 * the other NAKs come back the same when it is sent again.
+		 */
+		switch (rx[0]) {
+			case BSL_ERROR_HEADER_INCORRECT:
+			case BSL_ERROR_CHECKSUM_INCORRECT:
+				return EAGAIN;
+			case BSL_ERROR_PACKET_SIZE_ZERO:
+			case BSL_ERROR_PACKET_SIZE_TOO_BIG:
+			case BSL_ERROR_UNKNOWN_ERROR:
+			case BSL_ERROR_UNKNOWN_BAUD_RATE:
+				return 1;
+			default:
+				/* not an acknowledgement at all, damaged on the way */
+				return EBADMSG;
+		}
+	}
+
+	if (!core) {
+		return 0;
+	}
+
+	if (rx[1] != BSL_RSP_HEADER) {
+		log_printf("invalid response header\n");
+		return EBADMSG;
+	}
+
+	core_len = rx[2] | rx[3] << 8;
+	if (core_len == 0 || len < BSL_RSP_HEADER_SIZE + core_len + BSL_CRC_SIZE) {
+		log_printf("invalid response length\n");
+		return EBADMSG;
+	}
+
+	crc = rx[4 + core_len] | rx[5 + core_len] << 8
+		| rx[6 + core_len] << 16 | (uint32_t)rx[7 + core_len] << 24;
+	if (crc != crc32(&rx[4], core_len)) {
+		log_printf("invalid response checksum\n");
+		return EBADMSG;
+	}
+
+	return 0;
+}
+
+/* one round trip as capture records, see capture.h */
+static void capture_frame(struct bsl_intf *intf, uint8_t *tx,
+		uint32_t write_len, uint64_t start, uint8_t *rx, uint32_t read_len,
+		uint64_t end, int rc)
+{
+	int32_t error = rc;
+
+	capture_event(intf->capture, CAPTURE_TX, start, tx, write_len);
+	if (intf->t_written) {
+		capture_event(intf->capture, CAPTURE_TX_DONE, intf->t_written,
+				NULL, 0);
+	}
+	if (intf->t_first_rx) {
+		capture_event(intf->capture, CAPTURE_RX_FIRST, intf->t_first_rx,
+				NULL, 0);
+	}
+	if (rc) {
+		capture_event(intf->capture, CAPTURE_ERROR, end, &error,
+				sizeof(error));
+	} else {
+		capture_event(intf->capture, CAPTURE_RX, end, rx, read_len);
+	}
+}
+
+/*
+ * One round trip of a request. Send a command and receive the
+ * acknowledgement and, if core is set, the core response. read_len is the
+ * expected length of the response, a transport that can read
+ * incrementally follows the length field instead.
+ */
+static int bsl_exchange(struct bsl_intf *intf, uint8_t *tx,
+		uint8_t *rx, uint32_t rx_size, uint32_t read_len, bool core)
+{
+	uint32_t write_len = BSL_TX_LEN;
+	uint64_t start = 0, end = 0;
+	int rc;
+
+	dump_data("TX:", tx, write_len);
+	if (intf->trace) {
+		trace_frame(intf->trace, TRACE_TX, tx[3], tx, write_len, 0);
+	}
+
+	if (intf->timestamps) {
+		intf->t_written = 0;
+		intf->t_first_rx = 0;
+		start = stats_now();
+	}
+
+	rc = intf->transport->write_read(intf, tx, write_len,
+			rx, rx_size, &read_len, core);
+
+	if (intf->timestamps) {
+		end = stats_now();
+	}
+	if (intf->capture) {
+		capture_frame(intf, tx, write_len, start, rx, read_len, end, rc);
+	}
+
+	if (intf->trace) {
+		trace_frame(intf->trace, TRACE_RX, tx[3], rx, rc ? 0 : read_len, rc);
+	}
+
+	intf->tx_bytes += write_len;
+	if (rc == 0) {
+		intf->rx_bytes += read_len;
+		dump_data("RX:", rx, read_len);
+		rc = check_bsl_frame(rx, read_len, core);
+	}
+
+	/* a NAK or a damaged frame is an error of the exchange as well */
+	if (intf->stats) {
+		stats_record(intf->stats, tx[3], start, intf->t_written,
+				intf->t_first_rx, end, rc);
+	}
+
+	return rc;
+}
+
+bool bsl_core_response(uint8_t cmd)
+{
+	switch (cmd) {
+		case BSL_CMD_CONNECTION:
+		case BSL_CMD_PROGRAM_DATA_FAST:
+		case BSL_CMD_START_APPLICATION:
+		case BSL_CMD_CHANGE_BAUDRATE:
+			return false;
+		default:
+			return true;
+	}
+}
+
+bool bsl_link_error(int rc)
+{
+	return rc == EAGAIN || rc == ETIMEDOUT || rc == EBADMSG;
+}
+
+/* commands which give the same result when they are sent again */
+static bool bsl_idempotent(uint8_t cmd)
+{
+	switch (cmd) {
+		case BSL_CMD_CONNECTION:
+		case BSL_CMD_GET_DEVICE_INFO:
+		case BSL_CMD_PROGRAM_DATA:
+		case BSL_CMD_PROGRAM_DATA_FAST:
+		case BSL_CMD_STANDALONE_VERIFICATION:
+		case BSL_CMD_MEMORY_READ_BACK:
+			return true;
+		default:
+			return false;
+	}
+}
+
+#define BSL_RETRIES 2
+
+/*
+ * Send a request and receive the response. An idempotent request which
+ * failed on the link is sent again up to BSL_RETRIES times, after the
+ * rest of the broken exchange has been flushed. Programming the same data
+ * twice is fine, flash bits can only be cleared.
+ */
+static int bsl_write_read(struct bsl_intf *intf, uint8_t *tx,
+		uint8_t *rx, uint32_t rx_size, uint32_t read_len)
+{
+	bool core = bsl_core_response(tx[3]);
+	int rc;
+
+	for (int tries=0; ; tries++) {
+		rc = bsl_exchange(intf, tx, rx, rx_size, read_len, core);
+		if (rc == 0 || tries == BSL_RETRIES || !bsl_link_error(rc)
+				|| !bsl_idempotent(tx[3])) {
+			return rc;
+		}
+
+		DEBUG(0, "cmd 0x%02x: retry after error %d\n", tx[3], rc);
+		intf->retries++;
+		if (intf->stats) {
+			stats_retry(intf->stats, tx[3]);
+		}
+		if (intf->transport->flush) {
+			intf->transport->flush(intf);
+		}
+	}
+}
+
 int bsl_connect(struct bsl_intf *intf)
 {
 	int rc;
@@ -291,16 +394,10 @@ int bsl_connect(struct bsl_intf *intf)
 
 	memset(rx, 0, sizeof(rx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 1);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 1);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 1);
-
-	if ((rc = check_bsl_acknowledgement(rx[0])) != 0) {
-		return rc;
-	}
 
 	return 0;
 }
@@ -319,15 +416,13 @@ int bsl_get_device_info(struct bsl_intf *intf, struct bsl_device_info *info)
 
 	memset(rx, 0, sizeof(rx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 33);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 33);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 33);
 
-	if ((rc = check_bsl_acknowledgement(rx[0])) != 0) {
-		return rc;
+	if (rx[4] != BSL_CORE_RSP_GET_DEVICE_INFO) {
+		return check_bsl_response(rx, 10) ? 1 : EIO;
 	}
 
 	info->version = rx[5] | rx[6] << 8;
@@ -357,14 +452,12 @@ int bsl_unlock_bootloader(struct bsl_intf *intf)
 	memset(&tx[4], 0xff, 32);
 	add_crc(tx, sizeof(tx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 10);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 10);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 10);
 
-	if ((rc = check_bsl_acknowledgement(rx[0])) != 0) {
+	if ((rc = check_bsl_response(rx, 10)) != 0) {
 		return rc;
 	}
 
@@ -385,12 +478,10 @@ int bsl_mass_erase(struct bsl_intf *intf)
 	tx[3] = BSL_CMD_MASS_ERASE;
 	add_crc(tx, sizeof(tx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 10);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 10);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 10);
 
 	if ((rc = check_bsl_response(rx, 10)) != 0) {
 		return rc;
@@ -399,8 +490,7 @@ int bsl_mass_erase(struct bsl_intf *intf)
 	return 0;
 }
 
-int bsl_readback_data(struct bsl_intf *intf,
-		uint32_t start, uint32_t count)
+int bsl_flash_range_erase(struct bsl_intf *intf, uint32_t start, uint32_t end)
 {
 	int rc;
 	uint8_t tx[32];
@@ -411,59 +501,120 @@ int bsl_readback_data(struct bsl_intf *intf,
 	tx[0] = BSL_CMD_HEADER;
 	tx[1] = 9;
 	tx[2] = 0;
-	tx[3] = BSL_CMD_MEMORY_READ_BACK;
+	tx[3] = BSL_CMD_FLASH_RANGE_ERASE;
 	tx[4] = (start >> 0) & 0xff;
 	tx[5] = (start >> 8) & 0xff;
 	tx[6] = (start >> 16) & 0xff;
 	tx[7] = (start >> 24) & 0xff;
-	tx[8] = (count>> 0) & 0xff;
-	tx[9] = (count >> 8) & 0xff;
-	tx[10] = (count >> 16) & 0xff;
-	tx[11] = (count >> 24) & 0xff;
+	tx[8] = (end >> 0) & 0xff;
+	tx[9] = (end >> 8) & 0xff;
+	tx[10] = (end >> 16) & 0xff;
+	tx[11] = (end >> 24) & 0xff;
 	add_crc(tx, sizeof(tx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 9 + count);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 10);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 9 + count);
-
 
 	if ((rc = check_bsl_response(rx, 10)) != 0) {
 		return rc;
 	}
 
+	return 0;
+}
+
+int bsl_readback_data(struct bsl_intf *intf,
+		uint32_t start, uint32_t count)
+{
+	int rc;
+	uint8_t tx[32];
+	uint8_t *rx;
+
+	/* ack, header, response command, data and crc */
+	rx = calloc(1, 9 + count);
+	if (!rx) {
+		return ENOMEM;
+	}
+
+	tx[0] = BSL_CMD_HEADER;
+	tx[1] = 9;
+	tx[2] = 0;
+	tx[3] = BSL_CMD_MEMORY_READ_BACK;
+	tx[4] = (start >> 0) & 0xff;
+	tx[5] = (start >> 8) & 0xff;
+	tx[6] = (start >> 16) & 0xff;
+	tx[7] = (start >> 24) & 0xff;
+	tx[8] = (count>> 0) & 0xff;
+	tx[9] = (count >> 8) & 0xff;
+	tx[10] = (count >> 16) & 0xff;
+	tx[11] = (count >> 24) & 0xff;
+	add_crc(tx, sizeof(tx));
+
+	rc = bsl_write_read(intf, tx, rx, 9 + count, 9 + count);
+	if (rc == 0) {
+		rc = check_bsl_response(rx, 10);
+	}
+
+	free(rx);
+
 	return rc;
 }
 
-#define BSL_PROGRAM_TX_BUFFER_LEN BSL_PROGGRAM_DATA_MAX_LEN + 12
-int bsl_program_data(struct bsl_intf *intf,
+/* header, command, address and CRC */
+#define BSL_PROGRAM_OVERHEAD 12
+/* the request frame of a program data command in intf->tx_buf */
+static uint8_t *program_frame(struct bsl_intf *intf, uint8_t cmd,
 		uint32_t address, uint8_t *data, size_t len)
 {
-	int rc;
-	uint8_t tx[BSL_PROGRAM_TX_BUFFER_LEN];
-	uint8_t rx[32];
+	uint8_t *tx;
 
-	memset(rx, 0, sizeof(rx));
+	if (intf->tx_buf_len < len + BSL_PROGRAM_OVERHEAD) {
+		tx = realloc(intf->tx_buf, len + BSL_PROGRAM_OVERHEAD);
+		if (!tx) {
+			return NULL;
+		}
+		intf->tx_buf = tx;
+		intf->tx_buf_len = len + BSL_PROGRAM_OVERHEAD;
+	}
+	tx = intf->tx_buf;
 
 	tx[0] = BSL_CMD_HEADER;
 	tx[1] = (5 + len) & 0xff;
 	tx[2] = ((5 + len) >> 8) & 0xff;
-	tx[3] = BSL_CMD_PROGRAM_DATA;
+	tx[3] = cmd;
 	tx[4] = (address>> 0) & 0xff;
 	tx[5] = (address >> 8) & 0xff;
 	tx[6] = (address >> 16) & 0xff;
 	tx[7] = (address >> 24) & 0xff;
 	memcpy(tx+8, data, len);
-	add_crc(tx, sizeof(tx));
+	add_crc(tx, intf->tx_buf_len);
+
+	return tx;
+}
+
+int bsl_program_data(struct bsl_intf *intf,
+		uint32_t address, uint8_t *data, size_t len)
+{
+	int rc;
+	uint8_t *tx;
+	uint8_t rx[32];
+
+	if (len > BSL_PROGRAM_DATA_LIMIT) {
+		return EINVAL;
+	}
+
+	tx = program_frame(intf, BSL_CMD_PROGRAM_DATA, address, data, len);
+	if (!tx) {
+		return ENOMEM;
+	}
+
+	memset(rx, 0, sizeof(rx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 10);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 10);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 10);
 
 	if ((rc = check_bsl_response(rx, 10)) != 0) {
 		return rc;
@@ -472,6 +623,47 @@ int bsl_program_data(struct bsl_intf *intf,
 	return 0;
 }
 
+/*
+ * Like bsl_program_data(), but the BSL only acknowledges the frame and does
+ * not tell whether programming worked. Only a verification can.
+ */
+int bsl_program_data_fast(struct bsl_intf *intf,
+		uint32_t address, uint8_t *data, size_t len)
+{
+	uint8_t *tx;
+	uint8_t rx[1];
+
+	if (len > BSL_PROGRAM_DATA_LIMIT) {
+		return EINVAL;
+	}
+
+	tx = program_frame(intf, BSL_CMD_PROGRAM_DATA_FAST, address, data, len);
+	if (!tx) {
+		return ENOMEM;
+	}
+
+	rx[0] = 0;
+
+	return bsl_write_read(intf, tx, rx, sizeof(rx), 1);
+}
+
+size_t bsl_program_data_max_len(struct bsl_device_info *info)
+{
+	size_t len;
+
+	if (info->bsl_max_buffer_size <= BSL_PROGRAM_OVERHEAD) {
+		return BSL_PROGGRAM_DATA_MAX_LEN;
+	}
+
+	len = info->bsl_max_buffer_size - BSL_PROGRAM_OVERHEAD;
+	if (len > BSL_PROGRAM_DATA_LIMIT) {
+		len = BSL_PROGRAM_DATA_LIMIT;
+	}
+
+	/* the flash is written in 8 byte units */
+	return len & ~7;
+}
+
 int bsl_verification(struct bsl_intf *intf,
 		uint32_t address, uint32_t len, uint32_t *crc)
 {
@@ -495,17 +687,20 @@ int bsl_verification(struct bsl_intf *intf,
 	tx[11] = (len >> 24) & 0xff;
 	add_crc(tx, sizeof(tx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 13);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 13);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 13);
 
 	if ((rc = check_bsl_response(rx, 10)) != 0) {
 		return rc;
 	}
 
+	if (rx[4] != BSL_CORE_RSP_STANDALONE_VERIFICATION) {
+		log_printf("unexpected response 0x%02x\n", rx[4]);
+		return EIO;
+	}
+
 	*crc = rx[5] | rx[6] << 8 | rx[7] << 16 | rx[8] << 24;
 
 	return 0;
@@ -525,16 +720,10 @@ int bsl_start_application(struct bsl_intf *intf)
 	tx[3] = BSL_CMD_START_APPLICATION;
 	add_crc(tx, sizeof(tx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 1);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 1);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 10);
-
-	if ((rc = check_bsl_acknowledgement(rx[0])) != 0) {
-		return rc;
-	}
 
 	return 0;
 }
@@ -554,16 +743,17 @@ int bsl_change_baudrate(struct bsl_intf *intf, uint8_t baudrate)
 	tx[4] = baudrate;
 	add_crc(tx, sizeof(tx));
 
-	dump_data("TX:", tx, BSL_TX_LEN);
-	rc = bsl_write_read(intf, tx, BSL_TX_LEN, rx, 1);
+	rc = bsl_write_read(intf, tx, rx, sizeof(rx), 1);
 	if (rc) {
 		return rc;
 	}
-	dump_data("RX:", rx, 1);
-
-	if ((rc = check_bsl_acknowledgement(rx[0])) != 0) {
-		return rc;
-	}
 
 	return 0;
 }
+
+void bsl_release(struct bsl_intf *intf)
+{
+	free(intf->tx_buf);
+	intf->tx_buf = NULL;
+	intf->tx_buf_len = 0;
+}
@@ -13,6 +13,10 @@
 #define BSL_HEADER_SIZE 3
 #define BSL_CRC_SIZE 4
 
+/* acknowledgement, 0x08 and length in front of a core response */
+#define BSL_RSP_HEADER 0x08
+#define BSL_RSP_HEADER_SIZE 4
+
 #define BSL_TX_LEN (BSL_HEADER_SIZE + (tx[1] | (tx[2] << 8)) + BSL_CRC_SIZE)
 
 #define BSL_CMD_CONNECTION 0x12
@@ -20,6 +24,8 @@
 #define BSL_CMD_GET_DEVICE_INFO 0x19
 #define BSL_CMD_PROGRAM_DATA 0x20
 #define BSL_CMD_UNLOCK_BL 0x21
+#define BSL_CMD_FLASH_RANGE_ERASE 0x23
+#define BSL_CMD_PROGRAM_DATA_FAST 0x24
 #define BSL_CMD_STANDALONE_VERIFICATION 0x26
 #define BSL_CMD_MEMORY_READ_BACK 0x29
 #define BSL_CMD_START_APPLICATION 0x40
@@ -66,11 +72,42 @@ enum {
 	INTERFACE_TYPE_I2C
 };
 
+enum {
+	I2C_XFER_AUTO = 0,	/* combined, fall back to split on failure */
+	I2C_XFER_SPLIT,		/* separate write and read transfers */
+	I2C_XFER_COMBINED,	/* write and read with a repeated start */
+};
+
+struct bsl_transport;
+struct bsl_stats;
+struct capture;
+struct trace;
+
 struct bsl_intf {
+	const struct bsl_transport *transport;
+	void *priv;
 	int fd;
 	uint8_t i2c_address;
+	int i2c_xfer;
 	uint32_t baudrate;
-	int type;
+	uint8_t *tx_buf;
+	size_t tx_buf_len;
+	/* bytes on the link */
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	/* requests sent again after a link error */
+	uint64_t retries;
+	/* latency statistics, NULL if disabled */
+	struct bsl_stats *stats;
+	/* transports fill in t_written and t_first_rx */
+	bool timestamps;
+	/* stats_now() when the request was sent and the response started */
+	uint64_t t_written;
+	uint64_t t_first_rx;
+	/* ring of the last frames, NULL if disabled */
+	struct trace *trace;
+	/* wire capture, NULL if disabled */
+	struct capture *capture;
 };
 
 struct bsl_device_info {
@@ -84,10 +121,24 @@ struct bsl_device_info {
 	uint32_t bsl_config_id;
 };
 
-uint32_t crc32(uint8_t *buf, int len);
+/* bytes still missing to complete the response received so far */
+uint32_t bsl_response_missing(uint8_t *buf, uint32_t len, bool core);
+
+/* false for the commands which are answered with the acknowledgement only */
+bool bsl_core_response(uint8_t cmd);
 
+/*
+ * The commands return 0 on success, EAGAIN if the BSL rejected the request
+ * with a header or checksum NAK (it was not executed and may be sent
+ * again), ETIMEDOUT if the UART response did not arrive in time or an I2C
+ * transfer failed, EBADMSG if the response frame was damaged and another
+ * non-zero value otherwise.
+ */
 int bsl_connect(struct bsl_intf *intf);
 
+/* EAGAIN, ETIMEDOUT or EBADMSG, the link rather than the device failed */
+bool bsl_link_error(int rc);
+
 int bsl_start_application(struct bsl_intf *intf);
 
 int bsl_unlock_bootloader(struct bsl_intf *intf);
@@ -96,16 +147,31 @@ int bsl_get_device_info(struct bsl_intf *intf, struct bsl_device_info *info);
 
 int bsl_mass_erase(struct bsl_intf *intf);
 
+#define BSL_FLASH_SECTOR_SIZE 1024
+/* erases all sectors touched by start..end, end is inclusive */
+int bsl_flash_range_erase(struct bsl_intf *intf, uint32_t start, uint32_t end);
+
 int bsl_readback_data(struct bsl_intf *intf,
 		uint32_t start, uint32_t count);
 
 #define BSL_PROGGRAM_DATA_MAX_LEN 256
+/* limited by the 16 bit length field of the packet */
+#define BSL_PROGRAM_DATA_LIMIT (0xffff - 5)
 int bsl_program_data(struct bsl_intf *intf,
 		uint32_t address, uint8_t *data, size_t len);
+/* acknowledged only, the result is known after a verification */
+int bsl_program_data_fast(struct bsl_intf *intf,
+		uint32_t address, uint8_t *data, size_t len);
+
+size_t bsl_program_data_max_len(struct bsl_device_info *info);
 
+/* the standalone verification works on multiples of 1k */
+#define BSL_VERIFICATION_BLOCK_SIZE 1024
 int bsl_verification(struct bsl_intf *intf,
 		uint32_t address, uint32_t len, uint32_t *crc);
 
 int bsl_change_baudrate(struct bsl_intf *intf, uint8_t baudrate);
 
+void bsl_release(struct bsl_intf *intf);
+
 #endif /* #ifndef __BSL_H__ */
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+/* large enough that a session is written with few syscalls */
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+
+struct capture *capture_open(const char *filename, const char *device,
+		uint32_t baudrate)
+{
+	struct capture_file_header hdr;
+	struct capture *c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		return NULL;
+	}
+
+	if ((c->f = fopen(filename, "w")) == NULL) {
+		printf("ERROR: cannot open %s: %s\n", filename, strerror(errno));
+		free(c);
+		return NULL;
+	}
+	setvbuf(c->f, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.baudrate = baudrate;
+	snprintf(hdr.device, sizeof(hdr.device), "%s", device);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, c->f) != 1) {
+		c->error = 1;
+	}
+
+	return c;
+}
+
+void capture_event(struct capture *c, uint8_t type, uint64_t timestamp,
+		const void *data, uint32_t len)
+{
+	struct capture_record r;
+
+	memset(&r, 0, sizeof(r));
+	r.timestamp = timestamp;
+	r.len = len;
+	r.type = type;
+
+	if (fwrite(&r, sizeof(r), 1, c->f) != 1
+			|| (len && fwrite(data, len, 1, c->f) != 1)) {
+		c->error = 1;
+	}
+}
+
+int capture_close(struct capture *c)
+{
+	int rc;
+
+	rc = fclose(c->f) || c->error ? -1 : 0;
+	free(c);
+
+	return rc;
+}
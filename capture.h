@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Wire capture of a session, every frame exchanged by bsl_write_read()
+ * with nanosecond CLOCK_MONOTONIC timestamps. The file is a header
+ * followed by records, each record header is followed by len bytes:
+ *
+ *   CAPTURE_TX        request frame, timestamp when the write started
+ *   CAPTURE_TX_DONE   the transport has written the request (no data)
+ *   CAPTURE_RX_FIRST  first response byte received (no data)
+ *   CAPTURE_RX        response, timestamp when it was complete
+ *   CAPTURE_ERROR     the round trip failed, data is the int32 error
+ *   CAPTURE_BAUDRATE  the link speed changed, data is the uint32 rate
+ *
+ * TX_DONE and RX_FIRST are missing if the transport can not tell. All
+ * values are in host byte order. Analyzed and replayed by tools/bslcap.
+ */
+#define CAPTURE_MAGIC "BSLCAP01"
+
+enum {
+	CAPTURE_TX = 1,
+	CAPTURE_TX_DONE,
+	CAPTURE_RX_FIRST,
+	CAPTURE_RX,
+	CAPTURE_ERROR,
+	CAPTURE_BAUDRATE,
+};
+
+struct capture_file_header {
+	char magic[8];
+	uint32_t baudrate;	/* link speed at the start, 0 for I2C */
+	uint32_t reserved;
+	char device[64];
+};
+
+struct capture_record {
+	uint64_t timestamp;
+	uint32_t len;
+	uint8_t type;
+	uint8_t reserved[3];
+};
+
+struct capture {
+	FILE *f;
+	int error;
+};
+
+struct capture *capture_open(const char *filename, const char *device,
+		uint32_t baudrate);
+void capture_event(struct capture *c, uint8_t type, uint64_t timestamp,
+		const void *data, uint32_t len);
+int capture_close(struct capture *c);
+
+#endif /* #ifndef __CAPTURE_H__ */
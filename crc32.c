@@ -0,0 +1,533 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_PCLMUL
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32_HAVE_ARMV8
+#endif
+
+#include "crc32.h"
+
+#define POLY 0xEDB88320
+
+static uint32_t crc_table[16][256];
+
+static void crc32_table_init(void)
+{
+	for (int i=0; i<256; i++) {
+		uint32_t crc = i;
+
+		for (int j=0; j<8; j++) {
+			crc = (crc >> 1) ^ (POLY & -(crc & 1));
+		}
+		crc_table[0][i] = crc;
+	}
+
+	for (int i=0; i<256; i++) {
+		for (int k=1; k<16; k++) {
+			uint32_t crc = crc_table[k-1][i];
+			crc_table[k][i] = (crc >> 8) ^ crc_table[0][crc & 0xff];
+		}
+	}
+}
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool crc32_supported_always(void)
+{
+	return true;
+}
+
+static uint32_t crc32_update_bitwise(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	uint32_t mask;
+
+	for (size_t i=0; i<len; i++) {
+		crc = crc ^ buf[i];
+
+		for (int j=0; j<8; j++) {
+			mask = -(crc & 1);
+			crc = (crc >> 1) ^ (POLY & mask);
+		}
+	}
+	return crc;
+}
+
+static uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while (len--) {
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+	}
+	return crc;
+}
+
+static uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while (len >= 8) {
+		uint32_t one = load_le32(buf) ^ crc;
+		uint32_t two = load_le32(buf + 4);
+
+		crc = crc_table[7][one & 0xff] ^
+		      crc_table[6][(one >> 8) & 0xff] ^
+		      crc_table[5][(one >> 16) & 0xff] ^
+		      crc_table[4][one >> 24] ^
+		      crc_table[3][two & 0xff] ^
+		      crc_table[2][(two >> 8) & 0xff] ^
+		      crc_table[1][(two >> 16) & 0xff] ^
+		      crc_table[0][two >> 24];
+
+		buf += 8;
+		len -= 8;
+	}
+
+	return crc32_update_bytewise(crc, buf, len);
+}
+
+static uint32_t crc32_update_slice16(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while (len >= 16) {
+		uint32_t one = load_le32(buf) ^ crc;
+		uint32_t two = load_le32(buf + 4);
+		uint32_t three = load_le32(buf + 8);
+		uint32_t four = load_le32(buf + 12);
+
+		crc = crc_table[15][one & 0xff] ^
+		      crc_table[14][(one >> 8) & 0xff] ^
+		      crc_table[13][(one >> 16) & 0xff] ^
+		      crc_table[12][one >> 24] ^
+		      crc_table[11][two & 0xff] ^
+		      crc_table[10][(two >> 8) & 0xff] ^
+		      crc_table[9][(two >> 16) & 0xff] ^
+		      crc_table[8][two >> 24] ^
+		      crc_table[7][three & 0xff] ^
+		      crc_table[6][(three >> 8) & 0xff] ^
+		      crc_table[5][(three >> 16) & 0xff] ^
+		      crc_table[4][three >> 24] ^
+		      crc_table[3][four & 0xff] ^
+		      crc_table[2][(four >> 8) & 0xff] ^
+		      crc_table[1][(four >> 16) & 0xff] ^
+		      crc_table[0][four >> 24];
+
+		buf += 16;
+		len -= 16;
+	}
+
+	return crc32_update_slice8(crc, buf, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+static bool crc32_supported_pclmul(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul")
+		&& __builtin_cpu_supports("sse4.1");
+}
+
+/*
+ * Carry-less multiplication folding as described in Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction". The
+ * constants are those of the bit-reflected CRC32 polynomial. Operates on
+ * multiples of 16 bytes with at least 64 bytes, the tail is handled by the
+ * table driven code.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) =
+		{ 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) =
+		{ 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) =
+		{ 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[2] __attribute__((aligned(16))) =
+		{ 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+
+	buf += 64;
+	len -= 64;
+
+	/* fold four 128 bit lanes in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	/* fold the four lanes into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* remaining 16 byte blocks */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	/* fold 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	if (len >= 64) {
+		size_t chunk = len & ~(size_t)15;
+
+		crc = crc32_fold_pclmul(crc, buf, chunk);
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return crc32_update_slice16(crc, buf, len);
+}
+#endif /* CRC32_HAVE_PCLMUL */
+
+#ifdef CRC32_HAVE_ARMV8
+#if defined(__clang__)
+#define CRC32_ARMV8_TARGET __attribute__((target("crc")))
+#else
+#define CRC32_ARMV8_TARGET __attribute__((target("+crc")))
+#endif
+
+static bool crc32_supported_armv8(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+CRC32_ARMV8_TARGET
+static uint32_t crc32_update_armv8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while (len && ((uintptr_t)buf & 7)) {
+		crc = __crc32b(crc, *buf++);
+		len--;
+	}
+
+	while (len >= 32) {
+		uint64_t v[4];
+
+		memcpy(v, buf, sizeof(v));
+		crc = __crc32d(crc, v[0]);
+		crc = __crc32d(crc, v[1]);
+		crc = __crc32d(crc, v[2]);
+		crc = __crc32d(crc, v[3]);
+		buf += 32;
+		len -= 32;
+	}
+
+	while (len >= 8) {
+		uint64_t v;
+
+		memcpy(&v, buf, sizeof(v));
+		crc = __crc32d(crc, v);
+		buf += 8;
+		len -= 8;
+	}
+
+	while (len--) {
+		crc = __crc32b(crc, *buf++);
+	}
+
+	return crc;
+}
+#endif /* CRC32_HAVE_ARMV8 */
+
+const struct crc32_impl crc32_impls[] = {
+#ifdef CRC32_HAVE_PCLMUL
+	{ "pclmul", crc32_supported_pclmul, crc32_update_pclmul },
+#endif
+#ifdef CRC32_HAVE_ARMV8
+	{ "armv8", crc32_supported_armv8, crc32_update_armv8 },
+#endif
+	{ "slice16", crc32_supported_always, crc32_update_slice16 },
+	{ "slice8", crc32_supported_always, crc32_update_slice8 },
+	{ "bitwise", crc32_supported_always, crc32_update_bitwise },
+	{ NULL, NULL, NULL }
+};
+
+/*
+ * Polynomial arithmetic modulo the CRC polynomial in the bit-reflected
+ * domain, used to advance a CRC over a run of zero bytes in O(log n).
+ */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b >> 1) ^ (POLY & -(b & 1));
+	}
+
+	return p;
+}
+
+/* x^(2^n) modulo the CRC polynomial */
+static uint32_t x2n_table[32];
+
+static void x2n_table_init(void)
+{
+	uint32_t x = (uint32_t)1 << 30;
+
+	x2n_table[0] = x;
+	for (int i=1; i<32; i++) {
+		x2n_table[i] = x = multmodp(x, x);
+	}
+}
+
+/*
+ * Compare an implementation against the bitwise reference for a couple of
+ * lengths and misalignments, covering all tail paths of the fast variants.
+ */
+static int crc32_check(const struct crc32_impl *impl)
+{
+	static const size_t lengths[] = {
+		0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 63, 64, 65, 79, 127, 128,
+		129, 255, 256, 1023, 1024, 1031,
+	};
+	uint8_t buf[1024 + 32];
+	uint32_t seed = 0x12345678;
+
+	for (size_t i=0; i<sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	for (size_t off=0; off<16; off++) {
+		for (size_t i=0; i<sizeof(lengths)/sizeof(lengths[0]); i++) {
+			uint32_t ref, val;
+
+			ref = crc32_update_bitwise(CRC32_INIT, buf + off, lengths[i]);
+			val = impl->update(CRC32_INIT, buf + off, lengths[i]);
+			if (ref != val) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+static const struct crc32_impl *crc32_active;
+
+static void crc32_setup(void)
+{
+	crc32_table_init();
+	x2n_table_init();
+
+	for (const struct crc32_impl *impl = crc32_impls; impl->name; impl++) {
+		if (!impl->supported()) {
+			continue;
+		}
+		if (crc32_check(impl) != 0) {
+			fprintf(stderr, "WARNING: crc32 %s failed self-test\n", impl->name);
+			continue;
+		}
+		crc32_active = impl;
+		break;
+	}
+}
+
+const struct crc32_impl *crc32_impl_get(void)
+{
+	pthread_once(&crc32_once, crc32_setup);
+	return crc32_active;
+}
+
+int crc32_selftest(const struct crc32_impl *impl)
+{
+	crc32_impl_get();
+	return crc32_check(impl);
+}
+
+uint32_t crc32_init(void)
+{
+	return CRC32_INIT;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	return crc32_impl_get()->update(crc, buf, len);
+}
+
+uint32_t crc32_final(uint32_t crc)
+{
+	/* the BSL does not invert the result */
+	return crc;
+}
+
+uint32_t crc32(const uint8_t *buf, size_t len)
+{
+	return crc32_final(crc32_update(crc32_init(), buf, len));
+}
+
+/* x^(8 * len) modulo the CRC polynomial */
+static uint32_t x8nmodp(size_t len)
+{
+	uint32_t p = (uint32_t)1 << 31;
+	unsigned int k = 3;
+
+	crc32_impl_get();
+
+	while (len) {
+		if (len & 1) {
+			p = multmodp(x2n_table[k & 31], p);
+		}
+		len >>= 1;
+		k++;
+	}
+
+	return p;
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	return multmodp(x8nmodp(len2), crc1 ^ CRC32_INIT) ^ crc2;
+}
+
+int crc32_blocks_init(struct crc32_blocks *blocks,
+		const uint8_t *buf, size_t len, size_t block_size)
+{
+	size_t count = (len + block_size - 1) / block_size;
+
+	blocks->crc = malloc(count * sizeof(uint32_t));
+	if (!blocks->crc) {
+		return -1;
+	}
+
+	for (size_t i=0; i<count; i++) {
+		size_t n = block_size;
+
+		if (i == count - 1 && len % block_size) {
+			n = len % block_size;
+		}
+		blocks->crc[i] = crc32(buf + i * block_size, n);
+	}
+
+	blocks->count = count;
+	blocks->block_size = block_size;
+	blocks->len = len;
+	blocks->shift = x8nmodp(block_size);
+
+	return 0;
+}
+
+void crc32_blocks_free(struct crc32_blocks *blocks)
+{
+	free(blocks->crc);
+	blocks->crc = NULL;
+	blocks->count = 0;
+}
+
+uint32_t crc32_blocks_range(const struct crc32_blocks *blocks,
+		size_t first, size_t count)
+{
+	uint32_t crc;
+
+	assert(count > 0 && first + count <= blocks->count);
+
+	crc = blocks->crc[first];
+	for (size_t i=first+1; i<first+count; i++) {
+		uint32_t shift = blocks->shift;
+
+		if (i == blocks->count - 1 && blocks->len % blocks->block_size) {
+			shift = x8nmodp(blocks->len % blocks->block_size);
+		}
+		crc = multmodp(shift, crc ^ CRC32_INIT) ^ blocks->crc[i];
+	}
+
+	return crc;
+}
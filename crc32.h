@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32 as used by the BSL: reflected polynomial 0xEDB88320, initial value
+ * 0xFFFFFFFF and no final XOR.
+ */
+
+struct crc32_impl {
+	const char *name;
+	bool (*supported)(void);
+	uint32_t (*update)(uint32_t crc, const uint8_t *buf, size_t len);
+};
+
+/* all implementations, fastest first, terminated by an entry without name */
+extern const struct crc32_impl crc32_impls[];
+
+const struct crc32_impl *crc32_impl_get(void);
+int crc32_selftest(const struct crc32_impl *impl);
+
+#define CRC32_INIT 0xFFFFFFFF
+
+/* streaming interface */
+uint32_t crc32_init(void);
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+uint32_t crc32_final(uint32_t crc);
+
+/* CRC of A||B from the CRCs of A and B, len2 is the length of B */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+uint32_t crc32(const uint8_t *buf, size_t len);
+
+/*
+ * CRCs of the consecutive fixed size blocks of a buffer. Once computed, the
+ * CRC of any block aligned range is derived without touching the data again.
+ */
+struct crc32_blocks {
+	uint32_t *crc;
+	size_t count;
+	size_t block_size;
+	size_t len;
+	uint32_t shift;
+};
+
+int crc32_blocks_init(struct crc32_blocks *blocks,
+		const uint8_t *buf, size_t len, size_t block_size);
+void crc32_blocks_free(struct crc32_blocks *blocks);
+uint32_t crc32_blocks_range(const struct crc32_blocks *blocks,
+		size_t first, size_t count);
+
+#endif /* #ifndef __CRC32_H__ */
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+
+#include "bsl.h"
+#include "common.h"
+#include "log.h"
+#include "stats.h"
+#include "transport.h"
+
+extern int verbosity;
+
+static int i2c_transfer(int fd, struct i2c_msg *msgs, int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data packets;
+
+	packets.msgs = msgs;
+	packets.nmsgs = nmsgs;
+
+	return ioctl(fd, I2C_RDWR, &packets);
+}
+
+static int i2c_write_read_split(struct bsl_intf *intf, uint8_t *tx,
+		uint32_t write_len, uint8_t *rx, uint32_t read_len)
+{
+	uint8_t addr = intf->i2c_address;
+	int fd = intf->fd;
+	struct i2c_msg message;
+
+	memset(&message, 0, sizeof(message));
+
+	/* setup write message */
+	message.addr = addr;
+	message.flags = 0;
+	message.len = write_len;
+	message.buf = tx;
+
+	if (i2c_transfer(fd, &message, 1) < 0) {
+		int error_code = errno;
+		log_printf("%s: ioctl(I2C_RDWR) write failed and returned errno %s \n",
+				__func__, strerror(error_code));
+		return ETIMEDOUT;
+	}
+
+	if (intf->timestamps) {
+		intf->t_written = stats_now();
+	}
+
+	memset(&message, 0, sizeof(message));
+
+	/* setup read message */
+	message.addr = addr;
+	message.flags = I2C_M_RD;
+	message.len = read_len;
+	message.buf = rx;
+
+	if (i2c_transfer(fd, &message, 1) < 0) {
+		int error_code = errno;
+		log_printf("%s: ioctl(I2C_RDWR) read failed and returned errno %s \n",
+				__func__, strerror(error_code));
+		return ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+/* write and read in one transaction with a repeated start in between */
+static int i2c_write_read_combined(int fd, uint8_t addr, uint8_t *tx,
+		uint32_t write_len, uint8_t *rx, uint32_t read_len)
+{
+	struct i2c_msg messages[2];
+
+	memset(messages, 0, sizeof(messages));
+
+	messages[0].addr = addr;
+	messages[0].flags = 0;
+	messages[0].len = write_len;
+	messages[0].buf = tx;
+
+	messages[1].addr = addr;
+	messages[1].flags = I2C_M_RD;
+	messages[1].len = read_len;
+	messages[1].buf = rx;
+
+	if (i2c_transfer(fd, messages, 2) < 0) {
+		int error_code = errno;
+		DEBUG(0, "ioctl(I2C_RDWR) failed and returned errno %s\n",
+				strerror(error_code));
+		return ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+static int i2c_write_read_xfer(struct bsl_intf *intf, uint8_t *tx,
+		uint32_t write_len, uint8_t *rx, uint32_t read_len)
+{
+	int rc;
+
+	if (intf->i2c_xfer == I2C_XFER_SPLIT) {
+		return i2c_write_read_split(intf, tx, write_len, rx, read_len);
+	}
+
+	rc = i2c_write_read_combined(intf->fd, intf->i2c_address,
+			tx, write_len, rx, read_len);
+	if (rc == 0 || intf->i2c_xfer == I2C_XFER_COMBINED) {
+		return rc;
+	}
+
+	/*
+	 * The target did not answer within the repeated start, e.g. because
+	 * it is still busy with the command. Stay with separate transfers.
+	 */
+	DEBUG(0, "combined transfer failed, falling back to split transfers\n");
+	intf->i2c_xfer = I2C_XFER_SPLIT;
+
+	/*
+	 * The write may have reached the target already. Whether the request
+	 * can be sent again is up to bsl_write_read(), like for any other
+	 * link error.
+	 */
+	return rc;
+}
+
+/*
+ * I2C reads can not be continued, the expected length is read in one
+ * transfer.
+ */
+static int i2c_write_read(struct bsl_intf *intf, uint8_t *tx, uint32_t write_len,
+		uint8_t *rx, uint32_t rx_size, uint32_t *read_len, bool core)
+{
+	int rc;
+
+	assert(*read_len <= rx_size);
+
+	rc = i2c_write_read_xfer(intf, tx, write_len, rx, *read_len);
+	if (rc) {
+		return rc;
+	}
+
+	if (bsl_response_missing(rx, *read_len, core) > 0) {
+		log_printf("ERROR: incomplete response\n");
+		return EIO;
+	}
+
+	return 0;
+}
+
+static int i2c_open(struct bsl_intf *intf, const char *device)
+{
+	if ((intf->fd = open(device, O_RDWR)) < 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+static int i2c_configure(struct bsl_intf *intf)
+{
+	/* bind the target address once for the whole session */
+	if (ioctl(intf->fd, I2C_SLAVE, intf->i2c_address) < 0) {
+		int error_code = errno;
+		log_printf("ioctl(I2C_SLAVE) failed and returned errno %s \n",
+				strerror(error_code));
+	}
+
+	/* not fatal, the transfers carry the address as well */
+	return 0;
+}
+
+static void i2c_close(struct bsl_intf *intf)
+{
+	close(intf->fd);
+}
+
+const struct bsl_transport i2c_transport = {
+	.name = "i2c",
+	.open = i2c_open,
+	.configure = i2c_configure,
+	.write_read = i2c_write_read,
+	.close = i2c_close,
+};
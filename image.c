@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "image.h"
+
+extern int verbosity;
+
+static void error(const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf(": %s\n", strerror(errno));
+}
+
+
+int load_fw_image(const char *filename, uint8_t **_buf, size_t *_len, size_t len_pad)
+{
+	int fd;
+	int rc = 0;
+	ssize_t ret;
+	off_t len, ret2;
+	uint8_t *buf;
+
+	assert(_buf);
+	assert(_len);
+
+	DEBUG(0, "opening %s\n", filename);
+	if ((fd = open(filename, O_RDONLY)) == -1)
+	{
+		error("open(%s) failed", filename);
+		rc = errno;
+		goto err;
+	}
+
+	/* determine file length */
+	len = lseek(fd, 0, SEEK_END);
+	assert(len != (off_t)-1);
+	ret2 = lseek(fd, 0, SEEK_SET);
+	assert(ret2 != (off_t)-1);
+
+	DEBUG(0, "image_size=%ju\n", (intmax_t)len);
+
+	if (len == 0) {
+		printf("ERROR: empty file specified\n");
+		rc = EIO;
+		goto err_close;
+	}
+
+	/* pad len to 4k boundary */
+	if (len_pad == 0) {
+		len_pad = (len + 4095) & (~0xfff);
+	}
+
+	DEBUG(0, "image_size_padded=%zu\n", len_pad);
+
+	buf = malloc(len_pad);
+	assert(buf);
+	memset(buf, 0xff, len_pad);
+
+	ret = read(fd, buf, len);
+	if (ret == -1) {
+		error("read(%s) failed", filename);
+		free(buf);
+		rc = errno;
+		goto err_close;
+	}
+
+	if (ret != len) {
+		printf("ERROR: truncated read\n");
+		free(buf);
+		rc = EIO;
+		goto err_close;
+	}
+
+	*_len = len_pad;
+	*_buf = buf;
+
+err_close:
+	close(fd);
+err:
+
+	return rc;
+}
+
+int fw_image_load(struct fw_image *img, const char *filename)
+{
+	int rc;
+
+	memset(img, 0, sizeof(*img));
+
+	rc = load_fw_image(filename, &img->buf, &img->len, 0);
+	if (rc) {
+		return rc;
+	}
+
+	if (crc32_blocks_init(&img->blocks, img->buf, img->len,
+				IMAGE_BLOCK_SIZE) != 0) {
+		free(img->buf);
+		img->buf = NULL;
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+void fw_image_free(struct fw_image *img)
+{
+	crc32_blocks_free(&img->blocks);
+	free(img->buf);
+	img->buf = NULL;
+}
+
+typedef uint64_t image_vec __attribute__((vector_size(16)));
+
+/* number of leading erased bytes, in whole write granules */
+static size_t blank_span(const uint8_t *buf, size_t len)
+{
+	size_t n = 0;
+
+	/* 64 bytes per iteration, the AND reduction maps to SIMD */
+	while (len - n >= 64) {
+		image_vec v[4];
+
+		memcpy(v, buf + n, sizeof(v));
+		v[0] &= v[1] & v[2] & v[3];
+		if ((v[0][0] & v[0][1]) != UINT64_MAX) {
+			break;
+		}
+		n += 64;
+	}
+
+	while (len - n >= IMAGE_WRITE_GRANULE) {
+		uint64_t w;
+
+		memcpy(&w, buf + n, sizeof(w));
+		if (w != UINT64_MAX) {
+			return n;
+		}
+		n += IMAGE_WRITE_GRANULE;
+	}
+
+	/* partial granule at the end */
+	for (size_t i=n; i<len; i++) {
+		if (buf[i] != 0xff) {
+			return n;
+		}
+	}
+
+	return len;
+}
+
+/* number of leading bytes up to the next erased write granule */
+static size_t data_span(const uint8_t *buf, size_t len)
+{
+	size_t n = 0;
+
+	while (len - n >= IMAGE_WRITE_GRANULE) {
+		uint64_t w;
+
+		memcpy(&w, buf + n, sizeof(w));
+		if (w == UINT64_MAX) {
+			return n;
+		}
+		n += IMAGE_WRITE_GRANULE;
+	}
+
+	return len;
+}
+
+int image_data_extents(const uint8_t *buf, size_t len,
+		struct image_extent **_extents, size_t *_count)
+{
+	struct image_extent *extents = NULL;
+	size_t count = 0;
+	size_t pos = 0;
+
+	assert(_extents);
+	assert(_count);
+
+	while (pos < len) {
+		struct image_extent *tmp;
+		size_t start;
+
+		pos += blank_span(buf + pos, len - pos);
+		if (pos == len) {
+			break;
+		}
+
+		/* extend the extent over gaps too small to be worth a packet */
+		start = pos;
+		for (;;) {
+			size_t gap;
+
+			pos += data_span(buf + pos, len - pos);
+			gap = blank_span(buf + pos, len - pos);
+			if (gap >= IMAGE_MIN_GAP || pos + gap == len) {
+				break;
+			}
+			pos += gap;
+		}
+
+		tmp = realloc(extents, (count + 1) * sizeof(*extents));
+		if (!tmp) {
+			free(extents);
+			return ENOMEM;
+		}
+		extents = tmp;
+		extents[count].address = start;
+		extents[count].len = pos - start;
+		count++;
+	}
+
+	*_extents = extents;
+	*_count = count;
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc32.h"
+
+/* granularity of the block CRCs, that of the BSL verification command */
+#define IMAGE_BLOCK_SIZE 1024
+
+/* the flash is written in units of 8 bytes */
+#define IMAGE_WRITE_GRANULE 8
+
+/*
+ * Erased runs shorter than this are programmed anyway, splitting the
+ * packet would cost more than sending the 0xff bytes.
+ */
+#define IMAGE_MIN_GAP 256
+
+struct image_extent {
+	uint32_t address;
+	uint32_t len;
+};
+
+int load_fw_image(const char *filename, uint8_t **buf, size_t *len,
+		size_t len_pad);
+
+/*
+ * A loaded firmware image together with its 1k block CRCs. Read-only after
+ * fw_image_load(), so it can be shared by concurrent programming sessions.
+ */
+struct fw_image {
+	uint8_t *buf;
+	size_t len;
+	struct crc32_blocks blocks;
+};
+
+int fw_image_load(struct fw_image *img, const char *filename);
+void fw_image_free(struct fw_image *img);
+
+/*
+ * Split the image into runs which are not in erased state (0xff). The
+ * extents are aligned to IMAGE_WRITE_GRANULE, the caller frees the array.
+ */
+int image_data_extents(const uint8_t *buf, size_t len,
+		struct image_extent **extents, size_t *count);
+
+#endif /* #ifndef __IMAGE_H__ */
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "log.h"
+
+#define LOG_LINE_LEN 256
+
+static __thread const char *log_prefix;
+static __thread char log_line[LOG_LINE_LEN];
+static __thread size_t log_len;
+
+void log_set_prefix(const char *prefix)
+{
+	log_prefix = prefix;
+	log_len = 0;
+}
+
+static void log_emit(void)
+{
+	flockfile(stdout);
+	printf("[%s] %.*s\n", log_prefix, (int)log_len, log_line);
+	fflush(stdout);
+	funlockfile(stdout);
+}
+
+void log_printf(const char *fmt, ...)
+{
+	char buf[LOG_LINE_LEN];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	if (!log_prefix) {
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0) {
+		return;
+	}
+	if (len >= (int)sizeof(buf)) {
+		len = sizeof(buf) - 1;
+	}
+
+	for (int i=0; i<len; i++) {
+		if (buf[i] == '\n') {
+			log_emit();
+			log_len = 0;
+		} else if (log_len < sizeof(log_line)) {
+			log_line[log_len++] = buf[i];
+		}
+	}
+}
+
+void log_flush(void)
+{
+	if (log_prefix && log_len) {
+		log_emit();
+		log_len = 0;
+	}
+}
+
+bool log_prefixed(void)
+{
+	return log_prefix != NULL;
+}
+
+void log_partial(void)
+{
+	if (!log_prefix) {
+		fflush(stdout);
+	} else if (log_len) {
+		log_emit();
+	}
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdbool.h>
+
+/*
+ * Console output of the current thread. Without a prefix this is plain
+ * printf(). With a prefix the output is collected per line and each line
+ * is written as "[prefix] line", so several targets can be flashed in
+ * parallel without mixing up their output.
+ */
+void log_set_prefix(const char *prefix);
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_flush(void);
+
+bool log_prefixed(void);
+/*
+ * Show the line written so far, e.g. progress. With a prefix it is
+ * written as a line of its own and stays in the buffer to be continued.
+ */
+void log_partial(void);
+
+#endif /* #ifndef __LOG_H__ */
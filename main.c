@@ -8,31 +8,40 @@
 
 #include <assert.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <getopt.h>
-#include <stdarg.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "bsl.h"
+#include "capture.h"
 #include "common.h"
+#include "crc32.h"
+#include "image.h"
+#include "log.h"
+#include "report.h"
 #include "script.h"
+#include "stats.h"
+#include "trace.h"
+#include "transport.h"
 
 #ifndef VERSION
   #define VERSION "unrel"
 #endif
 
 #define DEFAULT_I2C_ADDR 0x48
-char *o_i2c_device = NULL;
 uint8_t o_i2c_address = DEFAULT_I2C_ADDR;
+int o_i2c_xfer = I2C_XFER_AUTO;
 
 #define DEFAULT_BAUDRATE 9600
-char *o_serial_device = NULL;
+/* -b auto, the fastest rate which passes baudrate_probe() */
+#define AUTO_BAUDRATE 0
 uint32_t o_serial_baudrate = DEFAULT_BAUDRATE;
 
 bool o_info = false;
@@ -40,335 +49,1711 @@ bool o_erase = false;
 bool o_no_script = false;
 bool o_program = false;
 bool o_crc = false;
+bool o_latency = false;
+unsigned int o_count = 100;
 uint32_t o_length = 0;
+size_t o_packet_size = 0;
+
+enum {
+	ERASE_MASS = 0,
+	ERASE_RANGE,
+};
+int o_erase_mode = ERASE_MASS;
+bool o_delta = false;
+bool o_resume = false;
+size_t o_verify_every = 0;
+bool o_fast = false;
+char *o_journal_file = NULL;
 bool o_do_start = false;
 char *o_fw_file = NULL;
+unsigned int o_jobs = 0;
+int o_report = REPORT_NONE;
+char *o_report_file = NULL;
+bool o_stats = false;
+char *o_trace_file = NULL;
+char *o_capture_file = NULL;
 
 int verbosity = 0;
 
-static struct termios old_tio;
+struct target {
+	int type;
+	char *device;
+	uint8_t i2c_address;	/* 0 = use -a */
+	bool run_script;
+	int rc;
+	double elapsed;
+	struct report report;
+	struct bsl_stats *stats;
+	struct trace *trace;
+};
+
+static struct target *targets = NULL;
+static size_t target_count = 0;
+static size_t target_next = 0;
+static pthread_mutex_t target_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static void error(const char* fmt, ...)
+static void usage(char* self)
 {
-	va_list ap;
-	va_start(ap, fmt);
-	vprintf(fmt, ap);
-	va_end(ap);
-	printf(": %s\n", strerror(errno));
+    printf(
+"Usage: %s [options] <CMD>\n"
+"\n"
+"  Flash and verify firmware binary to a TI MSPM0L microcontroller.\n"
+"\n"
+"  Options:\n"
+"  -a, --address ADDR      Using given I2C_ADDRESS for communication\n"
+"                          (default 0x48)\n"
+"\n"
+"  -b, --baud RATE         Using given baudrate for communication\n"
+"                          (default 9600), auto for the fastest rate\n"
+"                          which passes an integrity probe.\n"
+"\n"
+"  -I, --i2c  DEVICE       Using given I2C DEVICE for communication.\n"
+"                          Can be given multiple times.\n"
+"\n"
+"  -x, --i2c-xfer MODE     I2C transfer per command: combined (write and\n"
+"                          read with repeated start), split or auto\n"
+"                          (combined, falls back to split, default).\n"
+"\n"
+"  -S, --serial  DEVICE    Using given serial DEVICE for communication.\n"
+"                          Can be given multiple times.\n"
+"\n"
+"  -m, --manifest FILE     Read the target devices from FILE, one\n"
+"                          'serial DEVICE' or 'i2c DEVICE [ADDR]' per line.\n"
+"\n"
+"  -j, --jobs N            Flash at most N targets in parallel\n"
+"                          (default all).\n"
+"\n"
+"  -n, --no-script         Do not execute init/exit script.\n"
+"\n"
+"  -e, --erase MODE        Erase the whole flash (mass, default) or only\n"
+"                          the sectors covered by the image (range).\n"
+"\n"
+"  -d, --delta             Only reflash the 1k blocks which differ from\n"
+"                          the image.\n"
+"\n"
+"      --verify-every N    Verify every N KB while programming and\n"
+"                          flash a bad chunk again right away.\n"
+"\n"
+"      --fast              Program without waiting for the result of each\n"
+"                          packet, only the verification checks the data.\n"
+"\n"
+"      --resume            Continue an interrupted prog after the part\n"
+"                          of the image the device already holds,\n"
+"                          erasing only the rest.\n"
+"\n"
+"      --journal FILE      Log the programmed addresses to FILE (FILE.N\n"
+"                          for several targets) for a later --resume.\n"
+"\n"
+"  -l, --length            Length of CRC to calculate or flash to erase.\n"
+"\n"
+"  -p, --packet-size SIZE  Data bytes per program packet, multiple of 8\n"
+"                          (default derived from the BSL buffer size)\n"
+"\n"
+"  -s, --do-start          Start the application after programming.\n"
+"\n"
+"  -R, --report FORMAT     Print the time and link bytes per phase as\n"
+"                          json or kv (key=value lines) at the end.\n"
+"\n"
+"      --report-file FILE  Write the report to FILE instead of stdout.\n"
+"\n"
+"      --stats             Print latency percentiles per BSL command at\n"
+"                          the end.\n"
+"\n"
+"      --trace FILE        Write the last frames of each target to FILE\n"
+"                          (FILE.N for several targets), decode with\n"
+"                          tools/tracedump.\n"
+"\n"
+"      --capture FILE      Record every frame of each target with its\n"
+"                          timing to FILE (FILE.N for several targets),\n"
+"                          analyze or replay with tools/bslcap.\n"
+"\n"
+"  -v, --verbose           Increase verbosity, can be set multiple times.\n"
+"\n"
+"  -V, --version           Display program version and exit.\n"
+"\n"
+"  -h, --help              Display this help and exit.\n"
+"\n"
+"  CMD:\n"
+"    prog <fw-bin-file>   Program the firmware data.\n"
+"    info                 Display the device info.\n"
+"    erase                Erase the full flash or --length bytes in\n"
+"                         range mode.\n"
+"    crc [<fw-bin-file>]  Calculate the CRC or read from device.\n"
+"    latency [<count>]    Measure the round trip time of an empty and of\n"
+"                         a program sized packet for each I2C transfer\n"
+"                         mode.\n"
+"\n",
+        self);
 }
 
 
-static int load_fw_image(const char *filename, uint8_t **_buf, size_t *_len, size_t len_pad)
+int cmd_erase(struct bsl_intf *intf, uint32_t length)
 {
-	int fd;
-	int rc = 0;
-	ssize_t ret;
-	off_t len, ret2;
-	uint8_t *buf;
+	int rc;
+
+	report_begin(intf, REPORT_UNLOCK);
+	rc = bsl_unlock_bootloader(intf);
+	report_end(intf, REPORT_UNLOCK);
+	if (rc != 0) {
+		log_printf("ERROR: unlock device\n");
+		return -1;
+	}
+
+	if (o_erase_mode == ERASE_RANGE && length == 0) {
+		log_printf("ERROR: length need to be specified\n");
+		return -1;
+	}
+
+	report_begin(intf, REPORT_ERASE);
+	if (o_erase_mode == ERASE_RANGE) {
+		rc = bsl_flash_range_erase(intf, 0, length - 1);
+	} else {
+		rc = bsl_mass_erase(intf);
+	}
+	report_end(intf, REPORT_ERASE);
+
+	if (rc != 0) {
+		log_printf("ERROR: %s erase device\n",
+				o_erase_mode == ERASE_RANGE ? "range" : "mass");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int cmd_info(struct bsl_intf *intf)
+{
+	struct bsl_device_info info;
+
+	if (bsl_get_device_info(intf, &info) != 0) {
+		log_printf("ERROR: Get Device info\n");
+		return -1;
+	}
+
+	log_printf("CMD interpreter version:    0x%04x\n", info.version);
+	log_printf("Build ID:                   0x%04x\n", info.build_id);
+	log_printf("Application Version::       0x%08x\n", info.app_version);
+	log_printf("Plug-in interface Version:  0x%04x\n", info.interface_version);
+	log_printf("BSL max buffer size:        0x%04x\n", info.bsl_max_buffer_size);
+	log_printf("BSL buffer start address:   0x%08x\n", info.bsl_buffer_start);
+	log_printf("BCR configuration ID:       0x%08x\n", info.bcr_config_id);
+	log_printf("BSL configuration ID:       0x%08x\n", info.bsl_config_id);
+
+	return 0;
+}
+
+/* the rates the BSL supports, slowest first */
+static const struct {
+	uint32_t baudrate;
+	int code;
+} bsl_baudrates[] = {
+	{ 9600, BSL_UART_B9600 },
+	{ 19200, BSL_UART_B19200 },
+	{ 38400, BSL_UART_B38400 },
+	{ 57600, BSL_UART_B57600 },
+	{ 115200, BSL_UART_B115200 },
+	{ 1000000, BSL_UART_B1000000 },
+};
+
+#define BSL_BAUDRATES (sizeof(bsl_baudrates) / sizeof(bsl_baudrates[0]))
+
+static int baudrate_index(uint32_t baudrate)
+{
+	for (size_t i=0; i<BSL_BAUDRATES; i++) {
+		if (bsl_baudrates[i].baudrate == baudrate) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int set_speed(struct bsl_intf *intf, uint32_t baudrate)
+{
+	if (intf->transport->set_speed(intf, baudrate) != 0) {
+		return -1;
+	}
+
+	if (intf->capture) {
+		capture_event(intf->capture, CAPTURE_BAUDRATE, stats_now(),
+				&baudrate, sizeof(baudrate));
+	}
+
+	return 0;
+}
+
+static int change_baudrate(struct bsl_intf *intf, uint32_t baudrate)
+{
+	int i;
+
+	DEBUG(0, "change baudrate to %d\n", baudrate);
+
+	if ((i = baudrate_index(baudrate)) < 0) {
+		log_printf("ERROR: invalid baudrate\n");
+		return EINVAL;
+	}
+
+	if (bsl_change_baudrate(intf, bsl_baudrates[i].code) != 0) {
+		log_printf("ERROR: bsl_change_baudrate\n");
+		return -1;
+	}
+
+	return set_speed(intf, baudrate);
+}
+
+/*
+ * Baudrate fallback of the programming. A packet or another request of
+ * prog which fails with a link error even after the retransmissions is
+ * sent again one BSL rate lower.
+ * After LINK_STEP_UP good packets in a row the link goes up one rate
+ * again, up to the rate the programming started with, but not to a rate
+ * which has failed LINK_MAX_FAILURES times.
+ */
+#define LINK_STEP_UP 128
+#define LINK_MAX_FAILURES 2
+
+struct link {
+	uint32_t max_baudrate;
+	unsigned int good;
+	unsigned int failures[BSL_BAUDRATES];
+};
+
+static __thread struct link link_state;
+
+/*
+ * Move both sides to bsl_baudrates[i]. The acknowledgement of the change
+ * may be lost on a bad link, so a device info request decides whether the
+ * link works at the new rate.
+ */
+static int link_switch(struct bsl_intf *intf, int i)
+{
+	struct bsl_device_info info;
+
+	if (intf->transport->flush) {
+		intf->transport->flush(intf);
+	}
+	bsl_change_baudrate(intf, bsl_baudrates[i].code);
+	if (set_speed(intf, bsl_baudrates[i].baudrate) != 0) {
+		return -1;
+	}
+	if (intf->transport->flush) {
+		intf->transport->flush(intf);
+	}
+	if (bsl_get_device_info(intf, &info) != 0) {
+		return -1;
+	}
 
-	assert(_buf);
-	assert(_len);
+	log_printf("(%u)", bsl_baudrates[i].baudrate);
 
-	DEBUG(0, "opening %s\n", filename);
-	if ((fd = open(filename, O_RDONLY)) == -1)
-	{
-		error("open(%s) failed", filename);
-		rc = errno;
-		goto err;
+	return 0;
+}
+
+static int link_step_down(struct bsl_intf *intf)
+{
+	int i = baudrate_index(intf->baudrate);
+
+	if (!intf->transport->set_speed || i <= 0) {
+		return -1;
+	}
+
+	link_state.failures[i]++;
+	link_state.good = 0;
+	DEBUG(0, "%u baud failed %u times\n", intf->baudrate,
+			link_state.failures[i]);
+
+	return link_switch(intf, i - 1);
+}
+
+/* true if rc failed on the link and the request may be sent again slower */
+static bool link_recover(struct bsl_intf *intf, int rc)
+{
+	return bsl_link_error(rc) && link_step_down(intf) == 0;
+}
+
+static int link_step_up(struct bsl_intf *intf)
+{
+	int i;
+
+	if (intf->baudrate >= link_state.max_baudrate
+			|| ++link_state.good < LINK_STEP_UP) {
+		return 0;
+	}
+	link_state.good = 0;
+
+	i = baudrate_index(intf->baudrate) + 1;
+	if (link_state.failures[i] >= LINK_MAX_FAILURES) {
+		return 0;
+	}
+	if (link_switch(intf, i) == 0) {
+		return 0;
+	}
+
+	link_state.failures[i]++;
+	return link_switch(intf, i - 1);
+}
+
+/*
+ * Delay between two program packets. It is 0 as long as the device keeps
+ * up. A packet which needed a retransmission or failed on the link starts
+ * or doubles it, every PACING_DECAY good packets in a row halve it again.
+ */
+#define PACING_MIN_NS 50000
+#define PACING_MAX_NS 5000000
+#define PACING_DECAY 64
+
+struct pacing {
+	long delay_ns;
+	unsigned int good;
+	uint64_t last;		/* end of the previous packet */
+};
+
+static __thread struct pacing pacing;
+
+static void pacing_wait(void)
+{
+	uint64_t t = pacing.last + pacing.delay_ns;
+	struct timespec ts;
+
+	if (!pacing.delay_ns) {
+		return;
+	}
+
+	ts.tv_sec = t / 1000000000;
+	ts.tv_nsec = t % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+static void pacing_update(int rc, bool retried)
+{
+	if (retried || bsl_link_error(rc)) {
+		pacing.delay_ns = pacing.delay_ns ? pacing.delay_ns * 2 : PACING_MIN_NS;
+		if (pacing.delay_ns > PACING_MAX_NS) {
+			pacing.delay_ns = PACING_MAX_NS;
+		}
+		pacing.good = 0;
+		DEBUG(0, "pacing %ld us\n", pacing.delay_ns / 1000);
+	} else if (rc == 0 && pacing.delay_ns && ++pacing.good == PACING_DECAY) {
+		pacing.delay_ns /= 2;
+		if (pacing.delay_ns < PACING_MIN_NS) {
+			pacing.delay_ns = 0;
+		}
+		pacing.good = 0;
+	}
+
+	if (pacing.delay_ns) {
+		pacing.last = stats_now();
+	}
+}
+
+/*
+ * Progress dots of the programming, PROGRESS_DOTS for the whole image no
+ * matter how many packets it takes, flushed at most every
+ * PROGRESS_INTERVAL_NS. With several targets each flush is a whole line
+ * per target, so that happens less often.
+ */
+#define PROGRESS_DOTS 50
+#define PROGRESS_INTERVAL_NS 100000000
+#define PROGRESS_LINE_INTERVAL_NS 1000000000
+
+struct progress {
+	size_t total;
+	size_t done;
+	unsigned int dots;
+	uint64_t flushed;
+};
+
+static __thread struct progress progress;
+
+static void progress_start(size_t total)
+{
+	memset(&progress, 0, sizeof(progress));
+	progress.total = total;
+	progress.flushed = stats_now();
+}
+
+static void progress_add(size_t len)
+{
+	unsigned int dots;
+	uint64_t interval;
+	uint64_t now;
+
+	if (!progress.total) {
+		return;
+	}
+
+	progress.done += len;
+	dots = progress.done >= progress.total ? PROGRESS_DOTS
+		: progress.done * PROGRESS_DOTS / progress.total;
+	if (dots == progress.dots) {
+		return;
+	}
+	for (; progress.dots < dots; progress.dots++) {
+		log_printf(".");
+	}
+
+	interval = log_prefixed() ? PROGRESS_LINE_INTERVAL_NS
+		: PROGRESS_INTERVAL_NS;
+	now = stats_now();
+	if (now - progress.flushed >= interval) {
+		log_partial();
+		progress.flushed = now;
+	}
+}
+
+/*
+ * Journal of the programming, the end of every acknowledged packet is
+ * appended so that --resume knows where to look even after the process
+ * was killed. It is removed once the image is verified.
+ *
+ *   mspm0flash journal crc=0x1234abcd len=73728
+ *   0x000006b0
+ *   ...
+ */
+struct journal {
+	char filename[PATH_MAX];
+	FILE *f;
+};
+
+static __thread struct journal journal;
+
+/* end of the last acknowledged packet of img, 0 if unknown */
+static uint32_t journal_read(struct fw_image *img)
+{
+	uint32_t crc, address, end = 0;
+	size_t len;
+	FILE *f;
+
+	if (!journal.filename[0] || (f = fopen(journal.filename, "r")) == NULL) {
+		return 0;
+	}
+
+	if (fscanf(f, "mspm0flash journal crc=0x%x len=%zu", &crc, &len) == 2
+			&& crc == crc32_blocks_range(&img->blocks, 0, img->blocks.count)
+			&& len == img->len) {
+		while (fscanf(f, "%x", &address) == 1) {
+			if (address > end && address <= img->len) {
+				end = address;
+			}
+		}
+	}
+	fclose(f);
+
+	DEBUG(0, "journal: 0x%08x\n", end);
+
+	return end;
+}
+
+static int journal_open(struct fw_image *img, uint32_t start)
+{
+	if (!journal.filename[0]) {
+		return 0;
+	}
+
+	if ((journal.f = fopen(journal.filename, "w")) == NULL) {
+		log_printf("ERROR: cannot open journal %s: %s\n", journal.filename,
+				strerror(errno));
+		return -1;
+	}
+
+	fprintf(journal.f, "mspm0flash journal crc=0x%08x len=%zu\n",
+			crc32_blocks_range(&img->blocks, 0, img->blocks.count),
+			img->len);
+	if (start) {
+		fprintf(journal.f, "0x%08x\n", start);
+	}
+	fflush(journal.f);
+
+	return 0;
+}
+
+static void journal_ack(uint32_t end)
+{
+	if (journal.f) {
+		fprintf(journal.f, "0x%08x\n", end);
+		fflush(journal.f);
+	}
+}
+
+static void journal_close(bool done)
+{
+	if (!journal.f) {
+		return;
+	}
+
+	fclose(journal.f);
+	journal.f = NULL;
+	if (done) {
+		unlink(journal.filename);
+	}
+}
+
+static int program_extents(struct bsl_intf *intf, uint8_t *fw_buf,
+		uint32_t start, size_t len, size_t packet_len);
+
+/*
+ * Verification while programming. With --verify-every each completed
+ * chunk is compared with the block CRCs of the image, a bad chunk is
+ * erased and programmed again right away instead of being found by the
+ * final verification.
+ */
+#define CHUNK_RETRIES 2
+/* KB, more than any MSPM0 flash */
+#define VERIFY_EVERY_MAX 4096
+
+struct interleave {
+	const struct crc32_blocks *blocks;
+	size_t chunk_blocks;	/* 1k blocks per chunk, 0 = disabled */
+	uint32_t verified;	/* end of the verified part of the image */
+	unsigned int repaired;
+	bool repairing;
+};
+
+static __thread struct interleave interleave;
+
+static void interleave_start(const struct crc32_blocks *blocks,
+		uint32_t start)
+{
+	memset(&interleave, 0, sizeof(interleave));
+	interleave.blocks = blocks;
+	interleave.chunk_blocks = o_verify_every;
+	interleave.verified = start;
+}
+
+/* verify the chunks which are complete once the image is programmed to end */
+static int interleave_verify(struct bsl_intf *intf, uint8_t *fw_buf,
+		uint32_t end, size_t packet_len)
+{
+	size_t chunk = interleave.chunk_blocks * BSL_VERIFICATION_BLOCK_SIZE;
+
+	if (!chunk || interleave.repairing) {
+		return 0;
 	}
 
-	/* determine file length */
-	len = lseek(fd, 0, SEEK_END);
-	assert(len != (off_t)-1);
-	ret2 = lseek(fd, 0, SEEK_SET);
-	assert(ret2 != (off_t)-1);
+	while (end >= interleave.verified + chunk) {
+		uint32_t start = interleave.verified;
+		size_t first = start / BSL_VERIFICATION_BLOCK_SIZE;
+		uint32_t crc;
+		int rc;
+
+		for (int tries=0; ; tries++) {
+			if (bsl_verification(intf, start, chunk, &crc) != 0) {
+				log_printf("ERROR: bsl_verification\n");
+				return -1;
+			}
+			if (crc == crc32_blocks_range(interleave.blocks, first,
+						interleave.chunk_blocks)) {
+				break;
+			}
+			if (tries == CHUNK_RETRIES) {
+				log_printf("ERROR: 0x%08x: chunk does not verify\n", start);
+				return -1;
+			}
+
+			DEBUG(0, "0x%08x: chunk does not verify, reflash\n", start);
+			interleave.repairing = true;
+			rc = bsl_flash_range_erase(intf, start, start + chunk - 1);
+			if (rc == 0) {
+				rc = program_extents(intf, fw_buf, start, chunk, packet_len);
+			}
+			interleave.repairing = false;
+			if (rc != 0) {
+				return -1;
+			}
+			interleave.repaired++;
+		}
+		interleave.verified += chunk;
+	}
 
-	DEBUG(0, "image_size=%ju\n", (intmax_t)len);
+	return 0;
+}
 
-	if (len == 0) {
-		printf("ERROR: empty file specified\n");
-		rc = EIO;
-		goto err_close;
+static int program_range(struct bsl_intf *intf, uint8_t *fw_buf,
+		uint32_t address, size_t len, size_t packet_len)
+{
+	uint8_t *p = fw_buf + address;
+	size_t write_len;
+	int rc;
+
+	while (len > 0) {
+		if (len > packet_len) {
+			write_len = packet_len;
+		} else {
+			write_len = len;
+		}
+
+		/* bsl_program_data() already retransmits on link errors */
+		for (;;) {
+			uint64_t retries = intf->retries;
+
+			pacing_wait();
+			if (o_fast) {
+				rc = bsl_program_data_fast(intf, address, p,
+						write_len);
+			} else {
+				rc = bsl_program_data(intf, address, p,
+						write_len);
+			}
+			pacing_update(rc, intf->retries != retries);
+			if (rc == 0) {
+				break;
+			}
+			if (!bsl_link_error(rc) || link_step_down(intf) != 0) {
+				return -1;
+			}
+		}
+		progress_add(write_len);
+		journal_ack(address + write_len);
+
+		if (interleave_verify(intf, fw_buf, address + write_len,
+					packet_len) != 0) {
+			return -1;
+		}
+
+		if (link_step_up(intf) != 0) {
+			return -1;
+		}
+
+		p = p+write_len;
+		len -= write_len;
+		address += write_len;
+	}
+
+	return 0;
+}
+
+/* program the non-erased parts of fw_buf[start, start + len) */
+static int program_extents(struct bsl_intf *intf, uint8_t *fw_buf,
+		uint32_t start, size_t len, size_t packet_len)
+{
+	struct image_extent *extents;
+	size_t count;
+	size_t data_len = 0;
+	int rc = 0;
+
+	if (image_data_extents(fw_buf + start, len, &extents, &count) != 0) {
+		return -1;
+	}
+
+	for (size_t i=0; i<count; i++) {
+		data_len += extents[i].len;
+	}
+	DEBUG(0, "0x%08x: %zu extents, skipping %zu of %zu bytes\n",
+			start, count, len - data_len, len);
+
+	/* the skipped bytes count as done */
+	progress_add(len - data_len);
+
+	for (size_t i=0; i<count; i++) {
+		rc = program_range(intf, fw_buf, start + extents[i].address,
+				extents[i].len, packet_len);
+		if (rc) {
+			break;
+		}
+	}
+
+	free(extents);
+
+	return rc;
+}
+
+/* erase the sectors of fw_buf[start, start + len) and program them again */
+static int reflash_range(struct bsl_intf *intf, uint8_t *fw_buf,
+		uint32_t start, size_t len, size_t packet_len)
+{
+	int rc;
+
+	report_begin(intf, REPORT_ERASE);
+	rc = bsl_flash_range_erase(intf, start, start + len - 1);
+	report_end(intf, REPORT_ERASE);
+	if (rc != 0) {
+		log_printf("ERROR: range erase device\n");
+		return -1;
+	}
+
+	report_begin(intf, REPORT_PROGRAM);
+	rc = program_extents(intf, fw_buf, start, len, packet_len);
+	report_end(intf, REPORT_PROGRAM);
+
+	return rc;
+}
+
+/*
+ * Compare the device against the image in 1k blocks and reflash the runs
+ * of blocks which differ.
+ */
+static int prog_delta(struct bsl_intf *intf, uint8_t *fw_buf,
+		struct crc32_blocks *blocks, size_t block_count, size_t packet_len)
+{
+	size_t changed = 0;
+	size_t first = 0;
+	size_t run = 0;
+
+	log_printf("DELTA ..");
+	fflush(stdout);
+	progress_start(block_count * BSL_VERIFICATION_BLOCK_SIZE);
+	for (size_t i=0; i<=block_count; i++) {
+		uint32_t crc;
+		bool differs = false;
+
+		if (i < block_count) {
+			int rc;
+
+			report_begin(intf, REPORT_VERIFY);
+			rc = bsl_verification(intf, i * BSL_VERIFICATION_BLOCK_SIZE,
+					BSL_VERIFICATION_BLOCK_SIZE, &crc);
+			report_end(intf, REPORT_VERIFY);
+			if (rc != 0) {
+				log_printf("ERROR: bsl_verification\n");
+				return -1;
+			}
+			differs = crc != blocks->crc[i];
+		}
+
+		if (differs) {
+			if (run == 0) {
+				first = i;
+			}
+			run++;
+			changed++;
+			continue;
+		}
+
+		if (i < block_count) {
+			progress_add(BSL_VERIFICATION_BLOCK_SIZE);
+		}
+		if (run == 0) {
+			continue;
+		}
+
+		DEBUG(0, "reflash blocks %zu..%zu\n", first, first + run - 1);
+		if (reflash_range(intf, fw_buf, first * BSL_VERIFICATION_BLOCK_SIZE,
+					run * BSL_VERIFICATION_BLOCK_SIZE, packet_len) != 0) {
+			log_printf("ERROR: program data\n");
+			return -1;
+		}
+		run = 0;
+	}
+	log_printf(" %zu of %zu blocks changed\n", changed, block_count);
+
+	return 0;
+}
+
+/* does the device hold the 1k blocks [first, first + count) of img */
+static int verify_blocks(struct bsl_intf *intf, struct fw_image *img,
+		size_t first, size_t count, bool *match)
+{
+	uint32_t crc;
+
+	if (bsl_verification(intf, first * BSL_VERIFICATION_BLOCK_SIZE,
+				count * BSL_VERIFICATION_BLOCK_SIZE, &crc) != 0) {
+		log_printf("ERROR: bsl_verification\n");
+		return -1;
+	}
+	*match = crc == crc32_blocks_range(&img->blocks, first, count);
+
+	return 0;
+}
+
+/*
+ * Number of 1k blocks from the start of the image the device already
+ * holds. A binary search with one verification per step, starting from
+ * the blocks the journal knows about if they check out.
+ */
+static int resume_point(struct bsl_intf *intf, struct fw_image *img,
+		size_t *good)
+{
+	size_t lo = 0, hi = img->blocks.count;
+	size_t known = journal_read(img) / BSL_VERIFICATION_BLOCK_SIZE;
+	bool match;
+
+	if (known && verify_blocks(intf, img, 0, known, &match) == 0 && match) {
+		lo = known;
+	}
+
+	while (lo < hi) {
+		size_t mid = (lo + hi + 1) / 2;
+
+		if (verify_blocks(intf, img, lo, mid - lo, &match) != 0) {
+			return -1;
+		}
+		if (match) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	*good = lo;
+
+	return 0;
+}
+
+/*
+ * Mark the 1k blocks in [first, first + count) which differ from the
+ * image, the range as a whole is known to differ. If one half matches,
+ * the other one does not need to be verified.
+ */
+static int bisect_blocks(struct bsl_intf *intf, struct fw_image *img,
+		size_t first, size_t count, bool *bad)
+{
+	size_t half = count / 2;
+	bool match;
+
+	if (count == 1) {
+		bad[first] = true;
+		return 0;
+	}
+
+	if (verify_blocks(intf, img, first, half, &match) != 0) {
+		return -1;
+	}
+	if (!match) {
+		if (bisect_blocks(intf, img, first, half, bad) != 0) {
+			return -1;
+		}
+		if (verify_blocks(intf, img, first + half, count - half,
+					&match) != 0) {
+			return -1;
+		}
+		if (match) {
+			return 0;
+		}
+	}
+
+	return bisect_blocks(intf, img, first + half, count - half, bad);
+}
+
+/*
+ * After a failed final verification, find the blocks which differ and
+ * flash only their sectors again, up to REPAIR_ROUNDS times.
+ */
+#define REPAIR_ROUNDS 2
+
+static int repair_image(struct bsl_intf *intf, struct fw_image *img,
+		size_t packet_len)
+{
+	size_t count = img->blocks.count;
+	bool match = false;
+	bool *bad;
+	int rc = 0;
+
+	bad = calloc(count, sizeof(*bad));
+	if (!bad) {
+		return -1;
+	}
+
+	/* no chunk verification while repairing */
+	interleave.chunk_blocks = 0;
+
+	for (int round=0; rc == 0 && !match && round<REPAIR_ROUNDS; round++) {
+		memset(bad, 0, count * sizeof(*bad));
+		report_begin(intf, REPORT_VERIFY);
+		rc = bisect_blocks(intf, img, 0, count, bad);
+		report_end(intf, REPORT_VERIFY);
+
+		for (size_t i=0; rc == 0 && i<count; i++) {
+			size_t run = 0;
+
+			while (i + run < count && bad[i + run]) {
+				run++;
+			}
+			if (!run) {
+				continue;
+			}
+
+			log_printf("REPAIR 0x%08zx-0x%08zx .. ",
+					i * BSL_VERIFICATION_BLOCK_SIZE,
+					(i + run) * BSL_VERIFICATION_BLOCK_SIZE - 1);
+			rc = reflash_range(intf, img->buf,
+					i * BSL_VERIFICATION_BLOCK_SIZE,
+					run * BSL_VERIFICATION_BLOCK_SIZE, packet_len);
+			log_printf("%s\n", rc ? "ERROR" : "OK");
+			i += run;
+		}
+
+		if (rc == 0) {
+			log_printf("VERIFY .. ");
+			report_begin(intf, REPORT_VERIFY);
+			rc = verify_blocks(intf, img, 0, count, &match);
+			report_end(intf, REPORT_VERIFY);
+			if (rc == 0) {
+				log_printf("%s\n", match ? "OK" : "FAIL");
+			}
+		}
+	}
+
+	free(bad);
+
+	return rc == 0 && match ? 0 : -1;
+}
+
+/*
+ * Erase the image from start on. A resume keeps the verified prefix, but
+ * the sector after it is usually programmed in part and, without a
+ * journal, the rest may still hold another image.
+ */
+static int erase_image(struct bsl_intf *intf, uint32_t start,
+		uint32_t pad_len)
+{
+	bool range = start || o_erase_mode == ERASE_RANGE;
+	int rc;
+
+	log_printf("ERASE .. ");
+	report_begin(intf, REPORT_ERASE);
+	do {
+		if (range) {
+			/* only the sectors covered by the image */
+			rc = bsl_flash_range_erase(intf, start, pad_len - 1);
+		} else {
+			rc = bsl_mass_erase(intf);
+		}
+	} while (rc != 0 && link_recover(intf, rc));
+	report_end(intf, REPORT_ERASE);
+	if (rc != 0) {
+		log_printf("ERROR: %s erase device\n", range ? "range" : "mass");
+		return -1;
+	}
+	log_printf("OK\n");
+
+	return 0;
+}
+
+static int prog_image(struct bsl_intf *intf, struct fw_image *img)
+{
+	uint32_t pad_len;
+	uint32_t crc_file;
+	uint32_t crc_bsl;
+	uint32_t start = 0;
+	size_t packet_len;
+	int rc;
+
+	memset(&pacing, 0, sizeof(pacing));
+	memset(&link_state, 0, sizeof(link_state));
+	memset(&interleave, 0, sizeof(interleave));
+	link_state.max_baudrate = intf->baudrate;
+
+	packet_len = o_packet_size;
+	if (packet_len == 0) {
+		struct bsl_device_info info;
+
+		do {
+			rc = bsl_get_device_info(intf, &info);
+		} while (rc != 0 && link_recover(intf, rc));
+		if (rc != 0) {
+			log_printf("ERROR: Get Device info\n");
+			return -1;
+		}
+		packet_len = bsl_program_data_max_len(&info);
+	}
+	DEBUG(0, "packet_size=%zu\n", packet_len);
+
+	log_printf("UNLOCK .. ");
+	report_begin(intf, REPORT_UNLOCK);
+	do {
+		rc = bsl_unlock_bootloader(intf);
+	} while (rc != 0 && link_recover(intf, rc));
+	report_end(intf, REPORT_UNLOCK);
+	if (rc != 0) {
+		log_printf("ERROR: unlock device\n");
+		return -1;
+	}
+	log_printf("OK\n");
+
+	/* BSL only supports calculating 1k blocks */
+	pad_len = (img->len + BSL_VERIFICATION_BLOCK_SIZE - 1)
+		& ~(BSL_VERIFICATION_BLOCK_SIZE - 1);
+
+	if (o_delta) {
+		if (prog_delta(intf, img->buf, &img->blocks,
+				pad_len / BSL_VERIFICATION_BLOCK_SIZE, packet_len) != 0) {
+			return -1;
+		}
+		goto verify;
+	}
+
+	if (o_resume) {
+		size_t good;
+
+		log_printf("RESUME .. ");
+		report_begin(intf, REPORT_VERIFY);
+		rc = resume_point(intf, img, &good);
+		report_end(intf, REPORT_VERIFY);
+		if (rc != 0) {
+			return -1;
+		}
+		/* 0 if nothing usable is on the device, then erase as usual */
+		start = good * BSL_VERIFICATION_BLOCK_SIZE;
+		log_printf("0x%08x of 0x%08zx\n", start, img->len);
+	}
+
+	if (start < pad_len && erase_image(intf, start, pad_len) != 0) {
+		return -1;
+	}
+
+	if (journal_open(img, start) != 0) {
+		return -1;
+	}
+
+	/* the erased flash already holds 0xff, only program the data */
+	log_printf("FLASH ..");
+	fflush(stdout);
+	progress_start(img->len - start);
+	interleave_start(&img->blocks, start);
+	report_begin(intf, REPORT_PROGRAM);
+	rc = 0;
+	if (start < img->len) {
+		rc = program_extents(intf, img->buf, start, img->len - start,
+				packet_len);
+	}
+	report_end(intf, REPORT_PROGRAM);
+	if (rc != 0) {
+		log_printf("ERROR: program data\n");
+		return -1;
+	}
+	if (interleave.repaired) {
+		log_printf(" OK, %u chunks flashed again\n", interleave.repaired);
+	} else {
+		log_printf(" OK\n");
+	}
+
+verify:
+	log_printf("VERIFY .. ");
+	report_begin(intf, REPORT_VERIFY);
+	do {
+		rc = bsl_verification(intf, 0, pad_len, &crc_bsl);
+	} while (rc != 0 && link_recover(intf, rc));
+	report_end(intf, REPORT_VERIFY);
+	if (rc != 0) {
+		log_printf("ERROR: bsl_verification\n");
+		return -1;
+	}
+
+	crc_file = crc32_blocks_range(&img->blocks, 0,
+			pad_len / BSL_VERIFICATION_BLOCK_SIZE);
+
+	if (crc_file != crc_bsl) {
+		log_printf("FAIL\n");
+		if (repair_image(intf, img, packet_len) != 0) {
+			return -1;
+		}
+	} else {
+		log_printf("OK\n");
+	}
+
+	if (o_do_start) {
+		report_begin(intf, REPORT_START);
+		bsl_start_application(intf);
+		report_end(intf, REPORT_START);
+	};
+
+	return 0;
+}
+
+int cmd_prog(struct bsl_intf *intf, struct fw_image *img)
+{
+	int rc;
+
+	rc = prog_image(intf, img);
+	journal_close(rc == 0);
+
+	return rc;
+}
+
+int cmd_crc(struct bsl_intf *intf, char *filename, uint32_t length)
+{
+	int rc = 0;
+	uint32_t crc;
+
+	if (filename != NULL) {
+		uint8_t *fw_buf = NULL;
+		size_t total_len = 0;
+		DEBUG(0, "Load: %s, len=%x\n", filename, length);
+
+		if (load_fw_image(filename, &fw_buf, &total_len, length) != 0) {
+			return -1;
+		}
+
+		crc = crc32(fw_buf, total_len);
+
+		log_printf("0x%08x 0x%lx\n", crc, total_len);
+	} else {
+		if (length == 0) {
+			log_printf("ERROR: length need to be specified\n");
+			goto out;
+		} else {
+
+			if (length % 1024 != 0) {
+				log_printf("ERROR: length must be multiples of 1024\n");
+				goto out;
+			}
+		}
+
+		if (bsl_unlock_bootloader(intf) != 0) {
+			log_printf("ERROR: unlock device\n");
+			goto out;
+		}
+
+		if (bsl_verification(intf, 0, length, &crc) != 0) {
+			log_printf("ERROR: bsl_verification\n");
+			goto out;
+		}
+
+		log_printf("0x%08x 0x%x\n", crc, length);
+	}
+out:
+	return rc;
+}
+
+/*
+ * Round trip time of count requests. With len 0 the request is a device
+ * info, the fixed cost of a transaction. Otherwise len bytes are read back,
+ * a frame of the size of a program packet which does not touch the flash.
+ */
+static int measure_latency(struct bsl_intf *intf, const char *name,
+		unsigned int count, size_t len)
+{
+	struct bsl_device_info info;
+	double min = 0, max = 0, sum = 0;
+	int rc;
+
+	for (unsigned int i=0; i<count; i++) {
+		struct timespec t0, t1;
+		double us;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (len) {
+			rc = bsl_readback_data(intf, 0, len);
+		} else {
+			rc = bsl_get_device_info(intf, &info);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (rc != 0) {
+			log_printf("ERROR: %s\n", len ? "readback" : "Get Device info");
+			return -1;
+		}
+
+		us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+		if (i == 0 || us < min) {
+			min = us;
+		}
+		if (us > max) {
+			max = us;
+		}
+		sum += us;
+	}
+
+	log_printf("%-10s %5zu bytes %6u packets  min %8.1f us  avg %8.1f us  max %8.1f us\n",
+			name, len, count, min, sum / count, max);
+
+	return 0;
+}
+
+/*
+ * Round trip time of an empty and of a program sized transaction, per I2C
+ * transfer strategy. The program sized one is a readback, the payload is
+ * in the response instead of the request but the bus time is the same.
+ */
+int cmd_latency(struct bsl_intf *intf, unsigned int count)
+{
+	static const struct {
+		const char *name;
+		int xfer;
+	} modes[] = {
+		{ "split", I2C_XFER_SPLIT },
+		{ "combined", I2C_XFER_COMBINED },
+	};
+	struct bsl_device_info info;
+	int xfer = intf->i2c_xfer;
+	size_t packet_len;
+	int rc = 0;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	if (bsl_get_device_info(intf, &info) != 0) {
+		log_printf("ERROR: Get Device info\n");
+		return -1;
 	}
-
-	/* pad len to 4k boundary */
-	if (len_pad == 0) {
-		len_pad = (len + 4095) & (~0xfff);
+	packet_len = o_packet_size;
+	if (packet_len == 0) {
+		packet_len = bsl_program_data_max_len(&info);
 	}
 
-	DEBUG(0, "image_size_padded=%zu\n", len_pad);
-
-	buf = malloc(len_pad);
-	assert(buf);
-	memset(buf, 0xff, len_pad);
-
-	ret = read(fd, buf, len);
-	if (ret == -1) {
-		error("read(%s) failed", filename);
-		free(buf);
-		rc = errno;
-		goto err_close;
+	if (bsl_unlock_bootloader(intf) != 0) {
+		log_printf("ERROR: unlock device\n");
+		return -1;
 	}
 
-	if (ret != len) {
-		printf("ERROR: truncated read\n");
-		free(buf);
-		rc = EIO;
-		goto err_close;
+	if (intf->transport != &i2c_transport) {
+		rc |= measure_latency(intf, intf->transport->name, count, 0);
+		rc |= measure_latency(intf, intf->transport->name, count,
+				packet_len);
+		return rc;
 	}
 
-	*_len = len_pad;
-	*_buf = buf;
-
-err_close:
-	close(fd);
-err:
+	for (size_t i=0; i<sizeof(modes)/sizeof(modes[0]); i++) {
+		intf->i2c_xfer = modes[i].xfer;
+		rc |= measure_latency(intf, modes[i].name, count, 0);
+		rc |= measure_latency(intf, modes[i].name, count, packet_len);
+	}
+	intf->i2c_xfer = xfer;
 
 	return rc;
 }
 
-static void usage(char* self)
+static void version()
 {
-    printf(
-"Usage: %s [options] <CMD>\n"
-"\n"
-"  Flash and verify firmware binary to a TI MSPM0L microcontroller.\n"
-"\n"
-"  Options:\n"
-"  -a, --address ADDR      Using given I2C_ADDRESS for communication\n"
-"                          (default 0x48)\n"
-"\n"
-"  -b, --baud RATE         Using given baudrate for communication\n"
-"                          (default 9600)\n"
-"\n"
-"  -I, --i2c  DEVICE       Using given I2C DEVICE for communication.\n"
-"\n"
-"  -S, --serial  DEVICE    Using given serial DEVICE for communication.\n"
-"\n"
-"  -n, --no-script         Do not execute init/exit script.\n"
-"\n"
-"  -l, --length            Length of CRC to calculate.\n"
-"\n"
-"  -s, --do-start          Start the application after programming.\n"
-"\n"
-"  -v, --verbose           Increase verbosity, can be set multiple times.\n"
-"\n"
-"  -V, --version           Display program version and exit.\n"
-"\n"
-"  -h, --help              Display this help and exit.\n"
-"\n"
-"  CMD:\n"
-"    prog <fw-bin-file>   Program the firmware data.\n"
-"    info                 Display the device info.\n"
-"    erase                Erase the full flash.\n"
-"    crc [<fw-bin-file>]  Calculate the CRC or read from device.\n"
-"\n",
-        self);
+	printf("%s\n", VERSION);
 }
 
-
-int uart_set_baudrate(int fd, int baudrate)
+static void add_target(int type, const char *device, uint8_t i2c_address)
 {
-	struct termios tio;
+	struct target *t;
+
+	t = realloc(targets, (target_count + 1) * sizeof(*targets));
+	assert(t);
+	targets = t;
+
+	t = &targets[target_count++];
+	memset(t, 0, sizeof(*t));
+	t->type = type;
+	t->device = strdup(device);
+	t->i2c_address = i2c_address;
+	assert(t->device);
+}
 
-	memset(&tio, 0, sizeof(tio));
+/*
+ * One target per line:
+ *
+ *   serial /dev/ttyUSB0
+ *   i2c /dev/i2c-8 [ADDR]
+ */
+static int load_manifest(const char *filename)
+{
+	char line[512];
+	int lineno = 0;
+	FILE *f;
 
-	/* 8n1, baud, local connection, enable rx, sw flow control */
-	tio.c_cflag = CS8 | CLOCAL | CREAD;
+	if ((f = fopen(filename, "r")) == NULL) {
+		printf("ERROR: cannot open manifest %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
 
-	cfsetspeed(&tio, baudrate);
+	while (fgets(line, sizeof(line), f)) {
+		char type[16], device[256], address[16];
+		int n;
 
-	tio.c_oflag = 0;
-	tio.c_lflag = 0;
+		lineno++;
+		n = sscanf(line, "%15s %255s %15s", type, device, address);
+		if (n <= 0 || type[0] == '#') {
+			continue;
+		}
 
-	if (tcsetattr(fd, TCSANOW, &tio) == -1) {
-		printf("ERROR: tcsetattr %s\n", o_serial_device);
+		if (n >= 2 && !strcmp(type, "serial")) {
+			add_target(INTERFACE_TYPE_UART, device, 0);
+		} else if (n >= 2 && !strcmp(type, "i2c")) {
+			add_target(INTERFACE_TYPE_I2C, device,
+					n == 3 ? strtol(address, NULL, 0) : 0);
+		} else {
+			printf("ERROR: %s:%d: invalid target\n", filename, lineno);
+			fclose(f);
+			return -1;
+		}
 	}
 
+	fclose(f);
+
 	return 0;
 }
 
-int cmd_erase(struct bsl_intf *intf)
+struct baudrate_probe {
+	struct bsl_device_info info;
+	uint32_t crc;
+	bool verify;		/* the BSL is unlocked, crc is valid */
+};
+
+/*
+ * Exchange a few frames at the current rate and compare the answers with
+ * the ones at 9600 baud: the device info and the CRC of the first 1k.
+ */
+static int baudrate_probe(struct bsl_intf *intf, struct baudrate_probe *p)
 {
-	if (bsl_unlock_bootloader(intf) != 0) {
-		printf("ERROR: unlock device\n");
+	memset(&p->info, 0, sizeof(p->info));
+	if (bsl_get_device_info(intf, &p->info) != 0) {
 		return -1;
 	}
 
-	if (bsl_mass_erase(intf) != 0) {
-		printf("ERROR: mass erase device\n");
+	if (p->verify && bsl_verification(intf, 0, BSL_VERIFICATION_BLOCK_SIZE,
+				&p->crc) != 0) {
 		return -1;
 	}
 
 	return 0;
 }
 
-
-int cmd_info(struct bsl_intf *intf)
+/*
+ * Step up through the BSL rates until one fails the probe, then go back
+ * to the last good one. The change back is sent at the failing rate, its
+ * acknowledgement may well be garbled, so only the probe at the old rate
+ * decides if it worked.
+ */
+static int auto_baudrate(struct bsl_intf *intf)
 {
-	struct bsl_device_info info;
-
-	if (bsl_get_device_info(intf, &info) != 0) {
-		printf("ERROR: Get Device info\n");
+	struct baudrate_probe ref, probe;
+	uint32_t good = intf->baudrate;
+	int good_code = BSL_UART_B9600;
+
+	memset(&ref, 0, sizeof(ref));
+	ref.verify = bsl_unlock_bootloader(intf) == 0;
+	if (!ref.verify) {
+		DEBUG(0, "locked, probing with the device info only\n");
+	}
+	if (baudrate_probe(intf, &ref) != 0) {
+		log_printf("ERROR: baudrate probe at %u\n", good);
 		return -1;
 	}
+	probe = ref;
+
+	for (size_t i=1; i<BSL_BAUDRATES; i++) {
+		uint32_t baudrate = bsl_baudrates[i].baudrate;
+
+		if (bsl_change_baudrate(intf, bsl_baudrates[i].code) != 0
+				|| set_speed(intf, baudrate) != 0) {
+			DEBUG(0, "%u: change failed\n", baudrate);
+			break;
+		}
+
+		if (baudrate_probe(intf, &probe) == 0
+				&& !memcmp(&probe.info, &ref.info, sizeof(ref.info))
+				&& probe.crc == ref.crc) {
+			DEBUG(0, "%u: ok\n", baudrate);
+			good = baudrate;
+			good_code = bsl_baudrates[i].code;
+			continue;
+		}
+
+		DEBUG(0, "%u: probe failed\n", baudrate);
+		bsl_change_baudrate(intf, good_code);
+		if (set_speed(intf, good) != 0 || baudrate_probe(intf, &probe) != 0) {
+			log_printf("ERROR: cannot go back to %u baud\n", good);
+			return -1;
+		}
+		break;
+	}
 
-	printf("CMD interpreter version:    0x%04x\n", info.version);
-	printf("Build ID:                   0x%04x\n", info.build_id);
-	printf("Application Version::       0x%08x\n", info.app_version);
-	printf("Plug-in interface Version:  0x%04x\n", info.interface_version);
-	printf("BSL max buffer size:        0x%04x\n", info.bsl_max_buffer_size);
-	printf("BSL buffer start address:   0x%08x\n", info.bsl_buffer_start);
-	printf("BCR configuration ID:       0x%08x\n", info.bcr_config_id);
-	printf("BSL configuration ID:       0x%08x\n", info.bsl_config_id);
+	log_printf("BAUDRATE .. %u\n", good);
 
 	return 0;
 }
 
-int cmd_prog(struct bsl_intf *intf, char *filename)
+/* FILE for a single target, FILE.N if there are several */
+static void target_filename(struct target *t, const char *base,
+		char *filename, size_t size)
 {
-	int rc = 0;
-	size_t write_len;
-	uint8_t *p;
-	uint8_t *fw_buf = NULL;
-    size_t total_len = 0;
-	size_t len;
-	uint32_t address;
-	uint32_t pad_len;
-	uint32_t crc_file;
-	uint32_t crc_bsl;
+	if (target_count == 1) {
+		snprintf(filename, size, "%s", base);
+	} else {
+		snprintf(filename, size, "%s.%td", base, t - targets);
+	}
+}
 
-	if (load_fw_image(filename, &fw_buf, &total_len, 0) != 0) {
-		return -1;
+static int run_target(struct target *t, struct fw_image *img)
+{
+	struct bsl_intf intf = {0};
+	int rc = -1;
+
+	if (t->type == INTERFACE_TYPE_I2C) {
+		intf.transport = &i2c_transport;
+		intf.i2c_address = t->i2c_address ? t->i2c_address : o_i2c_address;
+		intf.i2c_xfer = o_i2c_xfer;
+	} else {
+		intf.transport = &uart_transport;
 	}
+	intf.stats = t->stats;
+	intf.trace = t->trace;
+	intf.timestamps = t->stats || o_capture_file;
 
-	printf("UNLOCK .. ");
-	if (bsl_unlock_bootloader(intf) != 0) {
-		printf("ERROR: unlock device\n");
-		goto out_free;
+	if (intf.transport->open(&intf, t->device) != 0) {
+		log_printf("ERROR: cannot open device %s\n", t->device);
+		return -1;
 	}
-	printf("OK\n");
 
-	printf("ERASE .. ");
-	if (bsl_mass_erase(intf) != 0) {
-		printf("ERROR: mass erase device\n");
-		goto out_free;
+	if (intf.transport->configure(&intf) != 0) {
+		goto out_close;
 	}
-	printf("OK\n");
 
+	if (o_capture_file) {
+		char filename[PATH_MAX];
 
-	p = fw_buf;
-	address = 0;
-	len = total_len;
-	printf("FLASH ..");
-	fflush(stdout);
-	while (len > 0) {
-		if (len > BSL_PROGGRAM_DATA_MAX_LEN) {
-			write_len = BSL_PROGGRAM_DATA_MAX_LEN;
-		} else {
-			write_len = len;
+		target_filename(t, o_capture_file, filename, sizeof(filename));
+		intf.capture = capture_open(filename, t->device, intf.baudrate);
+		if (!intf.capture) {
+			goto out_close;
 		}
+	}
 
-		if (bsl_program_data(intf, address, p, write_len) != 0) {
-			printf("ERROR: program data\n");
-			goto out_free;
-		}
+	if (o_journal_file) {
+		target_filename(t, o_journal_file, journal.filename,
+				sizeof(journal.filename));
+	} else {
+		journal.filename[0] = '\0';
+	}
 
-		usleep(100);
-		printf(".");
-		fflush(stdout);
+	if (t->run_script) {
+		report_begin(NULL, REPORT_SCRIPT_INIT);
+		rc = script_init();
+		report_end(NULL, REPORT_SCRIPT_INIT);
+		if (rc) {
+			log_printf("ERROR: script init\n");
+			goto out_close;
+		}
+	}
 
-		p = p+write_len;
-		len -= write_len;
-		address += write_len;
+	report_begin(&intf, REPORT_CONNECT);
+	rc = bsl_connect(&intf);
+	report_end(&intf, REPORT_CONNECT);
+	if (rc != 0) {
+		log_printf("ERROR: connect\n");
+		rc = -1;
+		goto out_close;
 	}
-	printf(" OK\n");
 
-	printf("VERIFY .. ");
-	/* BSL only supports calculating 1k blocks */
-	pad_len = (total_len+1023) & (~0x3ff);
+	if (intf.transport->set_speed && o_serial_baudrate != DEFAULT_BAUDRATE) {
+		report_begin(&intf, REPORT_BAUDRATE);
+		if (o_serial_baudrate == AUTO_BAUDRATE) {
+			rc = auto_baudrate(&intf);
+		} else {
+			rc = change_baudrate(&intf, o_serial_baudrate);
+		}
+		report_end(&intf, REPORT_BAUDRATE);
+		if (rc) {
+			goto out_close;
+		}
+	}
 
-	if (bsl_verification(intf, 0, pad_len, &crc_bsl) != 0) {
-		printf("ERROR: bsl_verification\n");
-		goto out_free;
+	if (o_erase) {
+		rc = cmd_erase(&intf, o_length);
+	} else if (o_info) {
+		rc = cmd_info(&intf);
+	} else if (o_program) {
+		rc = cmd_prog(&intf, img);
+	} else if (o_crc) {
+		rc = cmd_crc(&intf, NULL, o_length);
+	} else if (o_latency) {
+		rc = cmd_latency(&intf, o_count);
 	}
 
-	crc_file = crc32(fw_buf, pad_len);
+	if (t->run_script) {
+		report_begin(NULL, REPORT_SCRIPT_EXIT);
+		script_exit();
+		report_end(NULL, REPORT_SCRIPT_EXIT);
+	}
 
-	if (crc_file != crc_bsl) {
-		printf("FAIL\n");
+out_close:
+	if (intf.capture && capture_close(intf.capture) != 0) {
+		log_printf("ERROR: cannot write capture of %s\n", t->device);
 		rc = -1;
-		goto out_free;
 	}
-	printf("OK\n");
+	intf.transport->close(&intf);
+	bsl_release(&intf);
 
-	if (o_do_start) {
-		bsl_start_application(intf);
-	};
+	return rc;
+}
+
+/* the trace ring of a target, written once it is done */
+static void write_trace(struct target *t)
+{
+	char filename[PATH_MAX];
 
-out_free:
-	free(fw_buf);
+	if (!o_trace_file) {
+		return;
+	}
 
-	return rc;
+	target_filename(t, o_trace_file, filename, sizeof(filename));
+	trace_write(t->trace, t->device, filename);
 }
 
-int cmd_crc(struct bsl_intf *intf, char *filename, uint32_t length)
+static double now(void)
 {
-	int rc = 0;
-	uint32_t crc;
+	struct timespec ts;
 
-	if (filename != NULL) {
-		uint8_t *fw_buf = NULL;
-		size_t total_len = 0;
-		DEBUG(0, "Load: %s, len=%x\n", filename, length);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-		if (load_fw_image(filename, &fw_buf, &total_len, length) != 0) {
-			return -1;
+static void *target_worker(void *arg)
+{
+	struct fw_image *img = arg;
+
+	for (;;) {
+		struct target *t;
+		double start;
+
+		pthread_mutex_lock(&target_lock);
+		if (target_next == target_count) {
+			pthread_mutex_unlock(&target_lock);
+			break;
 		}
+		t = &targets[target_next++];
+		pthread_mutex_unlock(&target_lock);
+
+		log_set_prefix(t->device);
+		report_set(&t->report);
+		start = now();
+		t->rc = run_target(t, img);
+		t->elapsed = now() - start;
+		report_set(NULL);
+		write_trace(t);
+		log_flush();
+		log_printf("%s\n", t->rc ? "FAILED" : "DONE");
+		log_set_prefix(NULL);
+	}
 
-		crc = crc32(fw_buf, total_len);
+	return NULL;
+}
 
-		printf("0x%08x 0x%lx\n", crc, total_len);
-	} else {
-		if (length == 0) {
-			printf("ERROR: length need to be specified\n");
-			goto out;
-		} else {
+/* flash all targets concurrently, with up to o_jobs workers */
+static int run_targets(struct fw_image *img)
+{
+	unsigned int jobs = o_jobs;
+	pthread_t *workers;
+	unsigned int started = 0;
+	struct report script_report = {0};
+	int failed = 0;
+	int rc;
+
+	if (jobs == 0 || jobs > target_count) {
+		jobs = target_count;
+	}
 
-			if (length % 1024 != 0) {
-				printf("ERROR: length must be multiples of 1024\n");
-				goto out;
-			}
+	workers = calloc(jobs, sizeof(*workers));
+	assert(workers);
+
+	/* the script runs once for all targets, account it to each of them */
+	report_set(&script_report);
+	if (!o_no_script) {
+		report_begin(NULL, REPORT_SCRIPT_INIT);
+		rc = script_init();
+		report_end(NULL, REPORT_SCRIPT_INIT);
+		if (rc != 0) {
+			printf("ERROR: script init\n");
+			free(workers);
+			report_set(NULL);
+			return -1;
 		}
+	}
 
-		if (bsl_unlock_bootloader(intf) != 0) {
-			printf("ERROR: unlock device\n");
-			goto out;
+	for (unsigned int i=0; i<jobs; i++) {
+		if (pthread_create(&workers[i], NULL, target_worker, img) != 0) {
+			printf("ERROR: cannot create worker: %s\n", strerror(errno));
+			break;
 		}
+		started++;
+	}
 
-		if (bsl_verification(intf, 0, length, &crc) != 0) {
-			printf("ERROR: bsl_verification\n");
-			goto out;
-		}
+	if (started == 0) {
+		/* nothing picked up the targets */
+		target_worker(img);
+	}
 
-		printf("0x%08x 0x%x\n", crc, length);
+	for (unsigned int i=0; i<started; i++) {
+		pthread_join(workers[i], NULL);
 	}
-out:
-	return rc;
+	free(workers);
+
+	if (!o_no_script) {
+		report_begin(NULL, REPORT_SCRIPT_EXIT);
+		script_exit();
+		report_end(NULL, REPORT_SCRIPT_EXIT);
+	}
+	report_set(NULL);
+
+	for (size_t i=0; i<target_count; i++) {
+		targets[i].report.phase[REPORT_SCRIPT_INIT] =
+			script_report.phase[REPORT_SCRIPT_INIT];
+		targets[i].report.phase[REPORT_SCRIPT_EXIT] =
+			script_report.phase[REPORT_SCRIPT_EXIT];
+	}
+
+	printf("\nSUMMARY\n");
+	for (size_t i=0; i<target_count; i++) {
+		printf("  %-24s %-6s %8.2fs\n", targets[i].device,
+				targets[i].rc ? "FAILED" : "OK", targets[i].elapsed);
+		if (targets[i].rc) {
+			failed++;
+		}
+	}
+	printf("%zu targets, %d failed\n", target_count, failed);
+
+	return failed ? -1 : 0;
 }
 
-static void version()
+static int print_report(struct fw_image *img)
 {
-	printf("%s\n", VERSION);
+	struct report_target *r;
+	FILE *f = stdout;
+
+	if (o_report_file && (f = fopen(o_report_file, "w")) == NULL) {
+		printf("ERROR: cannot open %s: %s\n", o_report_file, strerror(errno));
+		return -1;
+	}
+
+	r = calloc(target_count, sizeof(*r));
+	assert(r);
+
+	for (size_t i=0; i<target_count; i++) {
+		r[i].device = targets[i].device;
+		r[i].report = &targets[i].report;
+		r[i].elapsed = targets[i].elapsed;
+		r[i].image_bytes = img->len;
+		r[i].rc = targets[i].rc;
+	}
+
+	report_print(f, o_report, r, target_count);
+
+	free(r);
+	if (f != stdout) {
+		fclose(f);
+	}
+
+	return 0;
 }
 
+enum {
+	OPT_REPORT_FILE = 0x100,
+	OPT_STATS,
+	OPT_TRACE,
+	OPT_CAPTURE,
+	OPT_RESUME,
+	OPT_JOURNAL,
+	OPT_VERIFY_EVERY,
+	OPT_FAST,
+};
+
 static struct option bsl_options[] = {
 	{ "address",    required_argument,  NULL,   'a'},
 	{ "baud",       required_argument,  NULL,   'b'},
+	{ "delta",      no_argument,        NULL,   'd'},
+	{ "erase",      required_argument,  NULL,   'e'},
 	{ "uart",       required_argument,  NULL,   'S'},
 	{ "i2c",        required_argument,  NULL,   'I'},
+	{ "i2c-xfer",   required_argument,  NULL,   'x'},
+	{ "jobs",       required_argument,  NULL,   'j'},
 	{ "length",     required_argument,  NULL,   'l'},
+	{ "manifest",   required_argument,  NULL,   'm'},
+	{ "packet-size", required_argument, NULL,   'p'},
 	{ "do-start",   no_argument,        NULL,   's'},
+	{ "report",     required_argument,  NULL,   'R'},
+	{ "report-file", required_argument, NULL,   OPT_REPORT_FILE},
+	{ "stats",      no_argument,        NULL,   OPT_STATS},
+	{ "trace",      required_argument,  NULL,   OPT_TRACE},
+	{ "capture",    required_argument,  NULL,   OPT_CAPTURE},
+	{ "resume",     no_argument,        NULL,   OPT_RESUME},
+	{ "journal",    required_argument,  NULL,   OPT_JOURNAL},
+	{ "verify-every", required_argument, NULL,  OPT_VERIFY_EVERY},
+	{ "fast",       no_argument,        NULL,   OPT_FAST},
 	{ "no-script",  no_argument,        NULL,   'n'},
 	{ "version",    no_argument,        NULL,   'V'},
 	{ "verbose",    no_argument,        NULL,   'v'},
@@ -381,28 +1766,113 @@ int main(int argc, char **argv)
 	int rc = -1;
 	int opt;
 	char **endptr = NULL;
+	char *end;
 	bool device_connection = true;
+	struct fw_image img = {0};
 
-	struct bsl_intf intf = {0};
-
-	while ((opt = getopt_long(argc, argv, "a:b:I:l:S:hnsvV",
+	while ((opt = getopt_long(argc, argv, "a:b:de:I:j:l:m:p:R:S:x:hnsvV",
 			bsl_options, NULL))!= -1) {
 		switch (opt) {
 			case 'a':
-				intf.i2c_address = strtol(optarg, endptr, 0);
+				o_i2c_address = strtol(optarg, endptr, 0);
 				break;
 			case 'b':
-				o_serial_baudrate = strtol(optarg, endptr, 0);
+				if (!strcmp(optarg, "auto")) {
+					o_serial_baudrate = AUTO_BAUDRATE;
+				} else {
+					o_serial_baudrate = strtol(optarg, endptr, 0);
+				}
+				break;
+			case 'd':
+				o_delta = true;
+				break;
+			case 'e':
+				if (!strcmp(optarg, "mass")) {
+					o_erase_mode = ERASE_MASS;
+				} else if (!strcmp(optarg, "range")) {
+					o_erase_mode = ERASE_RANGE;
+				} else {
+					printf("ERROR: invalid erase mode %s\n", optarg);
+					exit(1);
+				}
 				break;
 			case 'I':
-				o_i2c_device = optarg;
+				if (strlen(optarg)) {
+					add_target(INTERFACE_TYPE_I2C, optarg, 0);
+				}
 				break;
 			case 'S':
-				o_serial_device = optarg;
+				if (strlen(optarg)) {
+					add_target(INTERFACE_TYPE_UART, optarg, 0);
+				}
+				break;
+			case 'x':
+				if (!strcmp(optarg, "auto")) {
+					o_i2c_xfer = I2C_XFER_AUTO;
+				} else if (!strcmp(optarg, "split")) {
+					o_i2c_xfer = I2C_XFER_SPLIT;
+				} else if (!strcmp(optarg, "combined")) {
+					o_i2c_xfer = I2C_XFER_COMBINED;
+				} else {
+					printf("ERROR: invalid I2C transfer mode %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'j':
+				o_jobs = strtoul(optarg, endptr, 0);
 				break;
 			case 'l':
 				o_length = strtol(optarg, endptr, 0);
 				break;
+			case 'm':
+				if (load_manifest(optarg) != 0) {
+					exit(1);
+				}
+				break;
+			case 'p':
+				o_packet_size = strtol(optarg, endptr, 0);
+				if (o_packet_size == 0 || o_packet_size % 8
+						|| o_packet_size > BSL_PROGRAM_DATA_LIMIT) {
+					printf("ERROR: invalid packet size\n");
+					exit(1);
+				}
+				break;
+			case 'R':
+				o_report = report_parse_format(optarg);
+				if (o_report < 0) {
+					printf("ERROR: invalid report format %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_REPORT_FILE:
+				o_report_file = optarg;
+				break;
+			case OPT_STATS:
+				o_stats = true;
+				break;
+			case OPT_TRACE:
+				o_trace_file = optarg;
+				break;
+			case OPT_CAPTURE:
+				o_capture_file = optarg;
+				break;
+			case OPT_RESUME:
+				o_resume = true;
+				break;
+			case OPT_JOURNAL:
+				o_journal_file = optarg;
+				break;
+			case OPT_VERIFY_EVERY:
+				o_verify_every = strtoul(optarg, &end, 0);
+				if (*optarg == '\0' || *end != '\0' || o_verify_every == 0
+						|| o_verify_every > VERIFY_EVERY_MAX) {
+					printf("ERROR: invalid verify chunk %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_FAST:
+				o_fast = true;
+				break;
 			case 'h':
 				usage(argv[0]);
 				exit(0);
@@ -426,6 +1896,14 @@ int main(int argc, char **argv)
         }
     }
 
+	/* a chunk ends with a packet, unless the packet size is not given */
+	if (o_verify_every && o_packet_size
+			&& o_verify_every * 1024 % o_packet_size) {
+		printf("ERROR: --verify-every %zu KB is not a multiple of the "
+				"packet size\n", o_verify_every);
+		exit(1);
+	}
+
 	if ((argc-optind) < 1) {
 		usage(argv[0]);
 		printf("ERROR: CMD is missing\n");
@@ -444,6 +1922,11 @@ int main(int argc, char **argv)
 			exit(1);
 		}
 		o_fw_file = argv[optind+1];
+	} else if (!strcmp(argv[optind], "latency")) {
+		o_latency = true;
+		if ((argc - optind) >= 2) {
+			o_count = strtoul(argv[optind+1], endptr, 0);
+		}
 	} else if (!strcmp(argv[optind], "crc")) {
 		o_crc = true;
 		if ((argc - optind) >= 2) {
@@ -457,112 +1940,59 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (device_connection) {
-		if (o_i2c_device == NULL && o_serial_device == NULL) {
-			printf("ERROR: either I2C or SERIAL interface required\n");
-			exit(1);
-		}
-
-		if (o_i2c_device != NULL && strlen(o_i2c_device)) {
-			if ((intf.fd = open(o_i2c_device, O_RDWR)) < 0) {
-				printf("ERROR: cannot open device %s\n", o_i2c_device);
-				return -1;
-			}
-			intf.type = INTERFACE_TYPE_I2C;
-			intf.i2c_address = o_i2c_address;
-		} else if (o_serial_device != NULL && strlen(o_serial_device)) {
-
-			if ((intf.fd = open(o_serial_device, O_RDWR | O_NONBLOCK | O_NOCTTY)) < 0) {
-				printf("ERROR: cannot open device %s\n", o_serial_device);
-				return -1;
-			}
-
-			intf.type = INTERFACE_TYPE_UART;
-			intf.baudrate = o_serial_baudrate;
-
-		    tcflush(intf.fd, TCOFLUSH);
-			tcflush(intf.fd, TCIFLUSH);
-
-			rc = tcgetattr(intf.fd, &old_tio);
-			assert(rc != -1);
+	if (!device_connection) {
+		return cmd_crc(NULL, o_fw_file, o_length);
+	}
 
-			uart_set_baudrate(intf.fd, 9600);
-		}
+	if (target_count == 0) {
+		printf("ERROR: either I2C or SERIAL interface required\n");
+		exit(1);
+	}
 
-		if (!o_no_script) {
-			rc = script_init();
-			if (rc) {
-				printf("ERROR: script init\n");
-				goto out_close;
-			}
-		}
+	/* loaded once, shared by all targets */
+	if (o_program && fw_image_load(&img, o_fw_file) != 0) {
+		exit(1);
+	}
 
-		if (bsl_connect(&intf) != 0) {
-			printf("ERROR: connect\n");
-			goto out_close;
+	for (size_t i=0; i<target_count; i++) {
+		if (o_stats) {
+			targets[i].stats = calloc(1, sizeof(*targets[i].stats));
+			assert(targets[i].stats);
 		}
+		/* always recorded, it is cheap */
+		targets[i].trace = calloc(1, sizeof(*targets[i].trace));
+		assert(targets[i].trace);
 	}
 
+	if (target_count == 1) {
+		double start = now();
 
-
-	if (intf.type == INTERFACE_TYPE_UART && intf.baudrate != DEFAULT_BAUDRATE) {
-		int baud;
-
-		DEBUG(0, "change baudrate to %d\n", intf.baudrate);
-
-		/* get baudrate */
-		switch (intf.baudrate) {
-			case 19200: baud = BSL_UART_B19200; break;
-			case 38400: baud = BSL_UART_B38400; break;
-			case 57200: baud = BSL_UART_B57600; break;
-			case 115200: baud = BSL_UART_B115200; break;
-			case 1000000: baud = BSL_UART_B1000000; break;
-			default:
-				printf("ERROR: invalid baudrate\n");
-				rc = EINVAL;
-				goto out_close;
-		}
-		if (bsl_change_baudrate(&intf, baud) != 0) {
-			printf("ERROR: bsl_change_baudrate\n");
-			goto out_close;
-		}
-
-		switch (intf.baudrate) {
-			case 19200: baud = B19200; break;
-			case 38400: baud = B38400; break;
-			case 57200: baud = B57600; break;
-			case 115200: baud = B115200; break;
-			case 1000000: baud = B1000000; break;
-			default:
-				printf("ERROR: invalid baudrate\n");
-				rc = EINVAL;
-				goto out_close;
-		}
-		uart_set_baudrate(intf.fd, baud);
+		targets[0].run_script = !o_no_script;
+		report_set(&targets[0].report);
+		rc = run_target(&targets[0], &img);
+		report_set(NULL);
+		targets[0].rc = rc;
+		targets[0].elapsed = now() - start;
+		write_trace(&targets[0]);
+	} else {
+		rc = run_targets(&img);
 	}
 
-	if (o_erase) {
-		rc = cmd_erase(&intf);
-	} else if (o_info) {
-		rc = cmd_info(&intf);
-	} else if (o_program) {
-		rc = cmd_prog(&intf, o_fw_file);
-	} else if (o_crc) {
-		rc = cmd_crc(&intf, o_fw_file, o_length);
+	if (o_report != REPORT_NONE && print_report(&img) != 0) {
+		rc = -1;
 	}
 
-	if (device_connection) {
-		if (!o_no_script) {
-			script_exit();
-		}
+	for (size_t i=0; o_stats && i<target_count; i++) {
+		stats_print(stdout, targets[i].device, targets[i].stats);
 	}
 
-out_close:
-
-	if (intf.type == INTERFACE_TYPE_UART) {
-		tcsetattr(intf.fd, TCSANOW, &old_tio);
+	fw_image_free(&img);
+	for (size_t i=0; i<target_count; i++) {
+		free(targets[i].device);
+		free(targets[i].stats);
+		free(targets[i].trace);
 	}
-	close(intf.fd);
+	free(targets);
 
 	return rc;
 }
@@ -5,6 +5,9 @@ INSTALL_TARGETS += install-mspm0flash
 mspm0flash_SOURCES := $(wildcard *.c)
 mspm0flash_OBJECTS := $(addprefix $(o),$(mspm0flash_SOURCES:.c=.o))
 
+mspm0flash_CFLAGS := -pthread
+mspm0flash_LDFLAGS := -pthread
+
 $(o)%.o: %.c
 	$(call compile_tgt,mspm0flash)
 
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsl.h"
+#include "report.h"
+
+static const char *phase_names[REPORT_PHASES] = {
+	[REPORT_SCRIPT_INIT] = "script_init",
+	[REPORT_CONNECT] = "connect",
+	[REPORT_BAUDRATE] = "baudrate",
+	[REPORT_UNLOCK] = "unlock",
+	[REPORT_ERASE] = "erase",
+	[REPORT_PROGRAM] = "program",
+	[REPORT_VERIFY] = "verify",
+	[REPORT_START] = "start",
+	[REPORT_SCRIPT_EXIT] = "script_exit",
+};
+
+static __thread struct report *report_current;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report_set(struct report *r)
+{
+	report_current = r;
+}
+
+void report_begin(struct bsl_intf *intf, enum report_phase phase)
+{
+	struct report_entry *e;
+
+	if (!report_current) {
+		return;
+	}
+
+	e = &report_current->phase[phase];
+	e->start = now();
+	e->tx_start = intf ? intf->tx_bytes : 0;
+	e->rx_start = intf ? intf->rx_bytes : 0;
+}
+
+void report_end(struct bsl_intf *intf, enum report_phase phase)
+{
+	struct report_entry *e;
+
+	if (!report_current) {
+		return;
+	}
+
+	e = &report_current->phase[phase];
+	e->done = true;
+	e->elapsed += now() - e->start;
+	if (intf) {
+		e->tx_bytes += intf->tx_bytes - e->tx_start;
+		e->rx_bytes += intf->rx_bytes - e->rx_start;
+	}
+}
+
+int report_parse_format(const char *format)
+{
+	if (!strcmp(format, "json")) {
+		return REPORT_JSON;
+	} else if (!strcmp(format, "kv")) {
+		return REPORT_KV;
+	}
+
+	return -1;
+}
+
+static double rate(uint64_t bytes, double elapsed)
+{
+	return elapsed > 0 ? bytes / elapsed : 0;
+}
+
+/* a JSON string, quotes, backslashes and control characters escaped */
+static void print_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			fprintf(f, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(f, "\\u%04x", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+static void print_json(FILE *f, struct report_target *t, bool last)
+{
+	const char *sep = "";
+
+	fprintf(f, "    {\n");
+	fprintf(f, "      \"device\": ");
+	print_json_string(f, t->device);
+	fprintf(f, ",\n");
+	fprintf(f, "      \"rc\": %d,\n", t->rc);
+	fprintf(f, "      \"elapsed_s\": %.6f,\n", t->elapsed);
+	fprintf(f, "      \"image_bytes\": %ju,\n", (uintmax_t)t->image_bytes);
+	fprintf(f, "      \"image_bytes_per_s\": %.1f,\n",
+			rate(t->image_bytes, t->elapsed));
+	fprintf(f, "      \"phases\": {");
+	for (int i=0; i<REPORT_PHASES; i++) {
+		struct report_entry *e = &t->report->phase[i];
+
+		if (!e->done) {
+			continue;
+		}
+		fprintf(f, "%s\n        \"%s\": {\"elapsed_s\": %.6f, "
+				"\"tx_bytes\": %ju, \"rx_bytes\": %ju, "
+				"\"bytes_per_s\": %.1f}", sep, phase_names[i], e->elapsed,
+				(uintmax_t)e->tx_bytes, (uintmax_t)e->rx_bytes,
+				rate(e->tx_bytes + e->rx_bytes, e->elapsed));
+		sep = ",";
+	}
+	fprintf(f, "\n      }\n");
+	fprintf(f, "    }%s\n", last ? "" : ",");
+}
+
+static void print_kv(FILE *f, struct report_target *t)
+{
+	for (int i=0; i<REPORT_PHASES; i++) {
+		struct report_entry *e = &t->report->phase[i];
+
+		if (!e->done) {
+			continue;
+		}
+		fprintf(f, "device=%s phase=%s elapsed_s=%.6f tx_bytes=%ju "
+				"rx_bytes=%ju bytes_per_s=%.1f\n", t->device, phase_names[i],
+				e->elapsed, (uintmax_t)e->tx_bytes, (uintmax_t)e->rx_bytes,
+				rate(e->tx_bytes + e->rx_bytes, e->elapsed));
+	}
+	fprintf(f, "device=%s phase=total elapsed_s=%.6f image_bytes=%ju "
+			"image_bytes_per_s=%.1f rc=%d\n", t->device, t->elapsed,
+			(uintmax_t)t->image_bytes, rate(t->image_bytes, t->elapsed), t->rc);
+}
+
+void report_print(FILE *f, int format, struct report_target *targets,
+		size_t count)
+{
+	if (format == REPORT_JSON) {
+		fprintf(f, "{\n  \"targets\": [\n");
+	}
+
+	for (size_t i=0; i<count; i++) {
+		if (format == REPORT_JSON) {
+			print_json(f, &targets[i], i + 1 == count);
+		} else if (format == REPORT_KV) {
+			print_kv(f, &targets[i]);
+		}
+	}
+
+	if (format == REPORT_JSON) {
+		fprintf(f, "  ]\n}\n");
+	}
+	fflush(f);
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __REPORT_H__
+#define __REPORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct bsl_intf;
+
+enum report_phase {
+	REPORT_SCRIPT_INIT = 0,
+	REPORT_CONNECT,
+	REPORT_BAUDRATE,
+	REPORT_UNLOCK,
+	REPORT_ERASE,
+	REPORT_PROGRAM,
+	REPORT_VERIFY,
+	REPORT_START,
+	REPORT_SCRIPT_EXIT,
+	REPORT_PHASES
+};
+
+enum {
+	REPORT_NONE = 0,
+	REPORT_JSON,
+	REPORT_KV,
+};
+
+struct report_entry {
+	bool done;
+	double elapsed;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+
+	/* state of the running phase */
+	double start;
+	uint64_t tx_start;
+	uint64_t rx_start;
+};
+
+/*
+ * Time and link bytes spent per phase of a session. A phase may be entered
+ * several times, e.g. erase and program in delta mode, the times add up.
+ */
+struct report {
+	struct report_entry phase[REPORT_PHASES];
+};
+
+/* report of the current thread, phases are not recorded without one */
+void report_set(struct report *r);
+
+/* intf may be NULL for phases without link traffic */
+void report_begin(struct bsl_intf *intf, enum report_phase phase);
+void report_end(struct bsl_intf *intf, enum report_phase phase);
+
+int report_parse_format(const char *format);
+
+struct report_target {
+	const char *device;
+	struct report *report;
+	double elapsed;
+	uint64_t image_bytes;
+	int rc;
+};
+
+void report_print(FILE *f, int format, struct report_target *targets,
+		size_t count);
+
+#endif /* #ifndef __REPORT_H__ */
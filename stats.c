@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bsl.h"
+#include "stats.h"
+
+static const char *cmd_names[STATS_CMDS] = {
+	[STATS_CMD_CONNECT] = "connect",
+	[STATS_CMD_DEVICE_INFO] = "device_info",
+	[STATS_CMD_UNLOCK] = "unlock",
+	[STATS_CMD_MASS_ERASE] = "mass_erase",
+	[STATS_CMD_RANGE_ERASE] = "range_erase",
+	[STATS_CMD_PROGRAM_DATA] = "program_data",
+	[STATS_CMD_PROGRAM_FAST] = "program_fast",
+	[STATS_CMD_VERIFICATION] = "verification",
+	[STATS_CMD_READBACK] = "readback",
+	[STATS_CMD_START] = "start",
+	[STATS_CMD_CHANGE_BAUDRATE] = "change_baudrate",
+	[STATS_CMD_OTHER] = "other",
+};
+
+static unsigned int bucket_index(uint64_t value)
+{
+	unsigned int exp;
+
+	if (value < STATS_SUB) {
+		return value;
+	}
+
+	exp = 63 - __builtin_clzll(value);
+
+	return (exp - STATS_SUB_BITS + 1) * STATS_SUB
+		+ ((value >> (exp - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+/* highest value which falls into the bucket */
+static uint64_t bucket_limit(unsigned int index)
+{
+	unsigned int exp, sub;
+
+	if (index < STATS_SUB) {
+		return index;
+	}
+
+	exp = index / STATS_SUB + STATS_SUB_BITS - 1;
+	sub = index % STATS_SUB;
+
+	return (((uint64_t)(STATS_SUB + sub + 1)) << (exp - STATS_SUB_BITS)) - 1;
+}
+
+void stats_hist_add(struct stats_hist *h, uint64_t value)
+{
+	h->bucket[bucket_index(value)]++;
+	h->count++;
+	if (value > h->max) {
+		h->max = value;
+	}
+}
+
+uint64_t stats_hist_percentile(const struct stats_hist *h, double p)
+{
+	uint64_t rank, seen = 0;
+
+	if (h->count == 0) {
+		return 0;
+	}
+
+	rank = (uint64_t)(p / 100 * h->count + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (unsigned int i=0; i<STATS_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= rank) {
+			uint64_t low = i ? bucket_limit(i - 1) + 1 : 0;
+			uint64_t mid = low + (bucket_limit(i) - low) / 2;
+
+			return mid < h->max ? mid : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmd_index(uint8_t cmd)
+{
+	switch (cmd) {
+		case BSL_CMD_CONNECTION: return STATS_CMD_CONNECT;
+		case BSL_CMD_GET_DEVICE_INFO: return STATS_CMD_DEVICE_INFO;
+		case BSL_CMD_UNLOCK_BL: return STATS_CMD_UNLOCK;
+		case BSL_CMD_MASS_ERASE: return STATS_CMD_MASS_ERASE;
+		case BSL_CMD_FLASH_RANGE_ERASE: return STATS_CMD_RANGE_ERASE;
+		case BSL_CMD_PROGRAM_DATA: return STATS_CMD_PROGRAM_DATA;
+		case BSL_CMD_PROGRAM_DATA_FAST: return STATS_CMD_PROGRAM_FAST;
+		case BSL_CMD_STANDALONE_VERIFICATION: return STATS_CMD_VERIFICATION;
+		case BSL_CMD_MEMORY_READ_BACK: return STATS_CMD_READBACK;
+		case BSL_CMD_START_APPLICATION: return STATS_CMD_START;
+		case BSL_CMD_CHANGE_BAUDRATE: return STATS_CMD_CHANGE_BAUDRATE;
+		default: return STATS_CMD_OTHER;
+	}
+}
+
+void stats_record(struct bsl_stats *s, uint8_t cmd, uint64_t start,
+		uint64_t written, uint64_t first, uint64_t end, int rc)
+{
+	struct stats_cmd *c = &s->cmd[cmd_index(cmd)];
+
+	if (rc) {
+		c->errors++;
+		return;
+	}
+
+	if (written) {
+		stats_hist_add(&c->write, written - start);
+	}
+	if (first) {
+		stats_hist_add(&c->first, first - start);
+	}
+	stats_hist_add(&c->total, end - start);
+}
+
+void stats_retry(struct bsl_stats *s, uint8_t cmd)
+{
+	s->cmd[cmd_index(cmd)].retries++;
+}
+
+static void print_hist(FILE *f, const char *cmd, const char *name,
+		const struct stats_hist *h)
+{
+	static const double p[] = { 50, 90, 99, 99.9 };
+
+	if (h->count == 0) {
+		return;
+	}
+
+	fprintf(f, "  %-16s %-6s %8ju", cmd, name, (uintmax_t)h->count);
+	for (size_t i=0; i<sizeof(p)/sizeof(p[0]); i++) {
+		fprintf(f, " %10.1f", stats_hist_percentile(h, p[i]) / 1e3);
+	}
+	fprintf(f, " %10.1f\n", h->max / 1e3);
+}
+
+void stats_print(FILE *f, const char *device, const struct bsl_stats *s)
+{
+	fprintf(f, "\nSTATS %s (us)\n", device);
+	fprintf(f, "  %-16s %-6s %8s %10s %10s %10s %10s %10s\n", "command", "",
+			"count", "p50", "p90", "p99", "p99.9", "max");
+
+	for (int i=0; i<STATS_CMDS; i++) {
+		const struct stats_cmd *c = &s->cmd[i];
+
+		print_hist(f, cmd_names[i], "write", &c->write);
+		print_hist(f, cmd_names[i], "first", &c->first);
+		print_hist(f, cmd_names[i], "total", &c->total);
+		if (c->errors) {
+			fprintf(f, "  %-16s %-6s %8ju\n", cmd_names[i], "errors",
+					(uintmax_t)c->errors);
+		}
+		if (c->retries) {
+			fprintf(f, "  %-16s %-6s %8ju\n", cmd_names[i], "retry",
+					(uintmax_t)c->retries);
+		}
+	}
+	fflush(f);
+}
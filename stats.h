@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log bucketed histogram: values below STATS_SUB are counted exactly,
+ * above that each power of two is split into STATS_SUB buckets. The
+ * percentiles are reported as bucket midpoints, within 1/(2 * STATS_SUB)
+ * of the recorded value over the whole uint64_t range in fixed memory.
+ */
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB)
+
+struct stats_hist {
+	uint32_t bucket[STATS_BUCKETS];
+	uint64_t count;
+	uint64_t max;
+};
+
+void stats_hist_add(struct stats_hist *h, uint64_t value);
+uint64_t stats_hist_percentile(const struct stats_hist *h, double p);
+
+enum {
+	STATS_CMD_CONNECT = 0,
+	STATS_CMD_DEVICE_INFO,
+	STATS_CMD_UNLOCK,
+	STATS_CMD_MASS_ERASE,
+	STATS_CMD_RANGE_ERASE,
+	STATS_CMD_PROGRAM_DATA,
+	STATS_CMD_PROGRAM_FAST,
+	STATS_CMD_VERIFICATION,
+	STATS_CMD_READBACK,
+	STATS_CMD_START,
+	STATS_CMD_CHANGE_BAUDRATE,
+	STATS_CMD_OTHER,
+	STATS_CMDS
+};
+
+struct stats_cmd {
+	struct stats_hist write;	/* until the request is sent */
+	struct stats_hist first;	/* until the first response byte */
+	struct stats_hist total;	/* until the response is complete */
+	uint64_t errors;
+	uint64_t retries;	/* requests sent again after a link error */
+};
+
+/* per session, allocated up front, recording does not allocate */
+struct bsl_stats {
+	struct stats_cmd cmd[STATS_CMDS];
+};
+
+uint64_t stats_now(void);
+
+/*
+ * Record one round trip, the times are stats_now() values. written and
+ * first may be 0 if the transport can not tell them apart.
+ */
+void stats_record(struct bsl_stats *s, uint8_t cmd, uint64_t start,
+		uint64_t written, uint64_t first, uint64_t end, int rc);
+
+void stats_retry(struct bsl_stats *s, uint8_t cmd);
+
+void stats_print(FILE *f, const char *device, const struct bsl_stats *s);
+
+#endif /* #ifndef __STATS_H__ */
@@ -0,0 +1,61 @@
+ALL_TARGETS += $(o)tools/microbench $(o)tools/bslsim $(o)tools/bench $(o)tools/tracedump \
+	$(o)tools/bslcap
+CLEAN_TARGETS += clean-tools
+
+tools_CPPFLAGS := -I$(TOPDIR)
+tools_CFLAGS := -pthread
+
+microbench_SOURCES := tools/microbench.c crc32.c bsl.c image.c log.c stats.c trace.c \
+	capture.c
+microbench_OBJECTS := $(addprefix $(o),$(microbench_SOURCES:.c=.o))
+microbench_LDFLAGS := -pthread
+microbench_LIBS := -lm
+
+bslsim_SOURCES := tools/bslsim.c crc32.c
+bslsim_OBJECTS := $(addprefix $(o),$(bslsim_SOURCES:.c=.o))
+bslsim_LDFLAGS := -pthread
+
+tracedump_SOURCES := tools/tracedump.c trace.c
+tracedump_OBJECTS := $(addprefix $(o),$(tracedump_SOURCES:.c=.o))
+
+bslcap_SOURCES := tools/bslcap.c uart.c bsl.c crc32.c log.c stats.c trace.c \
+	capture.c
+bslcap_OBJECTS := $(addprefix $(o),$(bslcap_SOURCES:.c=.o))
+bslcap_LDFLAGS := -pthread
+
+bench_SOURCES := tools/bench.c
+bench_OBJECTS := $(addprefix $(o),$(bench_SOURCES:.c=.o))
+
+# end to end flashing benchmark against the simulator, see tools/bench.c
+BENCH_BASELINE ?= $(TOPDIR)/tools/bench-baseline.csv
+BENCH_ARGS ?=
+
+$(o)tools/%.o: tools/%.c
+	$(call compile_tgt,tools)
+
+$(o)tools/microbench: $(microbench_OBJECTS)
+	$(call link_tgt,microbench)
+
+$(o)tools/bslsim: $(bslsim_OBJECTS)
+	$(call link_tgt,bslsim)
+
+$(o)tools/tracedump: $(tracedump_OBJECTS)
+	$(call link_tgt,tracedump)
+
+$(o)tools/bslcap: $(bslcap_OBJECTS)
+	$(call link_tgt,bslcap)
+
+$(o)tools/bench: $(bench_OBJECTS)
+	$(call link_tgt,bench)
+
+.PHONY: bench
+bench: $(o)mspm0flash $(o)tools/bslsim $(o)tools/bench
+	$(o)tools/bench -F $(o)mspm0flash -S $(o)tools/bslsim \
+		-c $(BENCH_BASELINE) $(BENCH_ARGS)
+
+clean-tools:
+	rm -f $(microbench_OBJECTS) $(o)tools/microbench
+	rm -f $(bslsim_OBJECTS) $(o)tools/bslsim
+	rm -f $(bench_OBJECTS) $(o)tools/bench
+	rm -f $(tracedump_OBJECTS) $(o)tools/tracedump
+	rm -f $(bslcap_OBJECTS) $(o)tools/bslcap
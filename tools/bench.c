@@ -0,0 +1,633 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+/*
+ * End to end flashing benchmark. Runs "mspm0flash prog" against bslsim for
+ * a matrix of image sizes, baudrates, packet sizes and blank ratios and
+ * reports wall time, throughput, BSL round trips and host syscalls per
+ * kilobyte. "crc" is run for each size and baudrate, "info" for each
+ * baudrate. The syscalls are counted with ptrace, which adds a few
+ * microseconds per syscall to the wall time.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#define MAX_VALUES 16
+
+enum {
+	BENCH_PROG = 0,
+	BENCH_CRC,
+	BENCH_INFO,
+	BENCH_CMDS
+};
+
+static const char *cmd_names[BENCH_CMDS] = {
+	[BENCH_PROG] = "prog",
+	[BENCH_CRC] = "crc",
+	[BENCH_INFO] = "info",
+};
+
+struct matrix {
+	unsigned long values[MAX_VALUES];
+	int count;
+};
+
+struct result {
+	int cmd;
+	unsigned long size;
+	unsigned long baudrate;
+	unsigned long packet_size;
+	unsigned long blank;
+	double wall;
+	unsigned long frames;
+	unsigned long syscalls;
+	int rc;
+};
+
+struct baseline {
+	struct result *results;
+	int count;
+};
+
+static struct matrix sizes = { { 4096, 65536, 524288 }, 3 };
+static struct matrix baudrates = { { 9600, 115200, 1000000 }, 3 };
+static struct matrix packet_sizes = { { 256, 0 }, 2 };
+static struct matrix blanks = { { 0, 50 }, 2 };
+
+static const char *o_flasher = "./mspm0flash";
+static const char *o_sim = "./tools/bslsim";
+static const char *o_baseline = NULL;
+static const char *o_output = NULL;
+static bool o_json = false;
+static double o_threshold = 10;
+static bool o_commands[BENCH_CMDS] = { true, true, true };
+/* skip prog runs which need longer than this on the wire alone */
+static double o_max_wire = 60;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_matrix(struct matrix *m, char *arg)
+{
+	char *tok, *save;
+
+	m->count = 0;
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (m->count == MAX_VALUES) {
+			return -1;
+		}
+		m->values[m->count++] = strtoul(tok, NULL, 0);
+	}
+
+	return m->count ? 0 : -1;
+}
+
+static int cmd_index(const char *name)
+{
+	for (int cmd=0; cmd<BENCH_CMDS; cmd++) {
+		if (!strcmp(name, cmd_names[cmd])) {
+			return cmd;
+		}
+	}
+
+	return -1;
+}
+
+static int parse_commands(char *arg)
+{
+	char *tok, *save;
+	int cmd;
+
+	memset(o_commands, 0, sizeof(o_commands));
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if ((cmd = cmd_index(tok)) < 0) {
+			return -1;
+		}
+		o_commands[cmd] = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Pseudo random data where roughly blank percent of the 1k blocks are
+ * erased. The pattern is fixed so that runs are comparable.
+ */
+static int write_image(const char *filename, size_t size, unsigned long blank)
+{
+	uint32_t seed = 0x12345678;
+	uint8_t *buf;
+	FILE *f;
+	int rc = 0;
+
+	buf = malloc(size);
+	if (!buf) {
+		return -1;
+	}
+
+	for (size_t i=0; i<size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	for (size_t block=0; block<size/1024; block++) {
+		if ((block * 37) % 100 < blank) {
+			memset(buf + block * 1024, 0xff, 1024);
+		}
+	}
+
+	if ((f = fopen(filename, "w")) == NULL
+			|| fwrite(buf, 1, size, f) != size) {
+		rc = -1;
+	}
+	if (f && fclose(f)) {
+		rc = -1;
+	}
+	free(buf);
+
+	return rc;
+}
+
+static pid_t start_sim(unsigned long flash_size, FILE **out, char *pts, size_t len)
+{
+	char size_arg[32];
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds)) {
+		return -1;
+	}
+
+	fflush(NULL);
+	pid = fork();
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		snprintf(size_arg, sizeof(size_arg), "%lu", flash_size);
+		execl(o_sim, o_sim, "-s", "-f", size_arg, NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	*out = fdopen(fds[0], "r");
+	if (pid < 0 || !*out || !fgets(pts, len, *out)) {
+		printf("ERROR: cannot start %s\n", o_sim);
+		return -1;
+	}
+	pts[strcspn(pts, "\n")] = '\0';
+
+	return pid;
+}
+
+static unsigned long stop_sim(pid_t pid, FILE *out)
+{
+	unsigned long frames = 0;
+	char line[128];
+
+	kill(pid, SIGTERM);
+	while (fgets(line, sizeof(line), out)) {
+		sscanf(line, "frames=%lu", &frames);
+	}
+	fclose(out);
+	waitpid(pid, NULL, 0);
+
+	return frames;
+}
+
+/* run the flasher under ptrace and count the syscalls of all its threads */
+static int run_traced(char **argv, unsigned long *syscalls)
+{
+	int status, rc = -1;
+	pid_t pid, child;
+
+	fflush(NULL);
+	pid = fork();
+	if (pid == 0) {
+		freopen("/dev/null", "w", stdout);
+		freopen("/dev/null", "w", stderr);
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (pid < 0) {
+		return -1;
+	}
+
+	waitpid(pid, &status, 0);
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD
+			| PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+	*syscalls = 0;
+	while ((child = waitpid(-1, &status, __WALL)) > 0) {
+		int sig = 0;
+
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (child == pid) {
+				rc = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+				break;
+			}
+			continue;
+		}
+
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+			/* entry and exit stop */
+			(*syscalls)++;
+		} else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+			sig = WSTOPSIG(status);
+		}
+		ptrace(PTRACE_SYSCALL, child, NULL, (void *)(long)sig);
+	}
+	*syscalls /= 2;
+
+	return rc;
+}
+
+static int run_one(struct result *r)
+{
+	char image[] = "/tmp/mspm0bench-XXXXXX";
+	char baud_arg[32], packet_arg[32], length_arg[32];
+	char pts[128];
+	char *argv[16];
+	unsigned long flash_size;
+	FILE *sim_out;
+	double start;
+	pid_t sim;
+	int fd, argc = 0;
+
+	if (r->cmd == BENCH_PROG) {
+		fd = mkstemp(image);
+		if (fd < 0) {
+			return -1;
+		}
+		close(fd);
+
+		if (write_image(image, r->size, r->blank)) {
+			printf("ERROR: cannot write %s\n", image);
+			unlink(image);
+			return -1;
+		}
+	}
+
+	/* the image is padded to 4k by the flasher */
+	flash_size = (r->size + 4095) & ~4095ul;
+	if (flash_size < 128 * 1024) {
+		flash_size = 128 * 1024;
+	}
+
+	sim = start_sim(flash_size, &sim_out, pts, sizeof(pts));
+	if (sim < 0) {
+		if (r->cmd == BENCH_PROG) {
+			unlink(image);
+		}
+		return -1;
+	}
+
+	snprintf(baud_arg, sizeof(baud_arg), "%lu", r->baudrate);
+	snprintf(packet_arg, sizeof(packet_arg), "%lu", r->packet_size);
+	snprintf(length_arg, sizeof(length_arg), "%lu", r->size);
+
+	argv[argc++] = (char *)o_flasher;
+	argv[argc++] = "-n";
+	argv[argc++] = "-S";
+	argv[argc++] = pts;
+	argv[argc++] = "-b";
+	argv[argc++] = baud_arg;
+	switch (r->cmd) {
+		case BENCH_PROG:
+			if (r->packet_size) {
+				argv[argc++] = "-p";
+				argv[argc++] = packet_arg;
+			}
+			argv[argc++] = "prog";
+			argv[argc++] = image;
+			break;
+		case BENCH_CRC:
+			argv[argc++] = "-l";
+			argv[argc++] = length_arg;
+			argv[argc++] = "crc";
+			break;
+		case BENCH_INFO:
+			argv[argc++] = "info";
+			break;
+	}
+	argv[argc] = NULL;
+
+	start = now();
+	r->rc = run_traced(argv, &r->syscalls);
+	r->wall = now() - start;
+
+	r->frames = stop_sim(sim, sim_out);
+	if (r->cmd == BENCH_PROG) {
+		unlink(image);
+	}
+
+	return 0;
+}
+
+static int load_baseline(const char *filename, struct baseline *base)
+{
+	char line[256];
+	FILE *f;
+
+	if ((f = fopen(filename, "r")) == NULL) {
+		printf("ERROR: cannot open baseline %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct result r = {0};
+		struct result *results;
+		double bps, per_kb;
+		char cmd[16];
+
+		if (sscanf(line, "%15[^,],%lu,%lu,%lu,%lu,%lf,%lf,%lu,%lf,%d",
+				cmd, &r.size, &r.baudrate, &r.packet_size, &r.blank,
+				&r.wall, &bps, &r.frames, &per_kb, &r.rc) != 10
+				|| (r.cmd = cmd_index(cmd)) < 0) {
+			/* header */
+			continue;
+		}
+
+		results = realloc(base->results, (base->count + 1) * sizeof(r));
+		if (!results) {
+			fclose(f);
+			return -1;
+		}
+		base->results = results;
+		base->results[base->count++] = r;
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static struct result *find_baseline(struct baseline *base, struct result *r)
+{
+	for (int i=0; i<base->count; i++) {
+		struct result *b = &base->results[i];
+
+		if (b->cmd == r->cmd && b->size == r->size
+				&& b->baudrate == r->baudrate
+				&& b->packet_size == r->packet_size && b->blank == r->blank) {
+			return b;
+		}
+	}
+
+	return NULL;
+}
+
+static void print_result(FILE *f, struct result *r, struct result *b, bool first)
+{
+	/* info moves no image data, only the wall time counts */
+	double bps = r->size / r->wall;
+	double per_kb = r->size ? r->syscalls / (r->size / 1024.0) : 0;
+
+	if (o_json) {
+		fprintf(f, "%s  {\"cmd\": \"%s\", \"size\": %lu, \"baudrate\": %lu, "
+				"\"packet_size\": %lu, "
+				"\"blank\": %lu, \"wall_s\": %.6f, \"bytes_per_s\": %.1f, "
+				"\"round_trips\": %lu, \"syscalls_per_kb\": %.2f, \"rc\": %d",
+				first ? "" : ",\n", cmd_names[r->cmd], r->size, r->baudrate,
+				r->packet_size, r->blank, r->wall, bps, r->frames, per_kb, r->rc);
+		if (b) {
+			fprintf(f, ", \"baseline_bytes_per_s\": %.1f, \"change_pct\": %.1f",
+					b->size / b->wall, (b->wall / r->wall - 1) * 100);
+		}
+		fprintf(f, "}");
+		return;
+	}
+
+	fprintf(f, "%s,%lu,%lu,%lu,%lu,%.6f,%.1f,%lu,%.2f,%d",
+			cmd_names[r->cmd], r->size, r->baudrate, r->packet_size, r->blank,
+			r->wall, bps, r->frames, per_kb, r->rc);
+	if (o_baseline) {
+		if (b) {
+			fprintf(f, ",%.1f,%.1f", b->size / b->wall,
+					(b->wall / r->wall - 1) * 100);
+		} else {
+			fprintf(f, ",,");
+		}
+	}
+	fprintf(f, "\n");
+}
+
+static void usage(char *self)
+{
+	printf(
+"Usage: %s [options]\n"
+"\n"
+"  -F, --flasher PATH      mspm0flash binary (default ./mspm0flash)\n"
+"  -S, --sim PATH          bslsim binary (default ./tools/bslsim)\n"
+"  -C, --commands LIST     Commands to run (default prog,crc,info)\n"
+"  -s, --sizes LIST        Image sizes (default 4096,65536,524288)\n"
+"  -b, --baudrates LIST    Baudrates (default 9600,115200,1000000)\n"
+"  -p, --packet-sizes LIST Packet sizes, 0 for the device maximum\n"
+"                          (default 256,0)\n"
+"  -z, --blank LIST        Percentage of erased 1k blocks (default 0,50)\n"
+"  -m, --max-wire SEC      Skip prog runs whose image alone needs longer\n"
+"                          on the wire (default 60)\n"
+"  -c, --compare FILE      Compare against a CSV baseline\n"
+"  -t, --threshold PCT     Throughput loss that counts as a regression\n"
+"                          (default 10)\n"
+"  -o, --output FILE       Write the results to FILE instead of stdout\n"
+"  -j, --json              JSON instead of CSV output\n"
+"  -h, --help              Display this help and exit.\n"
+"\n",
+		self);
+}
+
+static struct option bench_options[] = {
+	{ "flasher",      required_argument,  NULL,   'F'},
+	{ "sim",          required_argument,  NULL,   'S'},
+	{ "commands",     required_argument,  NULL,   'C'},
+	{ "sizes",        required_argument,  NULL,   's'},
+	{ "baudrates",    required_argument,  NULL,   'b'},
+	{ "packet-sizes", required_argument,  NULL,   'p'},
+	{ "blank",        required_argument,  NULL,   'z'},
+	{ "max-wire",     required_argument,  NULL,   'm'},
+	{ "compare",      required_argument,  NULL,   'c'},
+	{ "threshold",    required_argument,  NULL,   't'},
+	{ "output",       required_argument,  NULL,   'o'},
+	{ "json",         no_argument,        NULL,   'j'},
+	{ "help",         no_argument,        NULL,   'h'},
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	struct baseline base = {0};
+	bool first = true;
+	int regressions = 0;
+	FILE *out = stdout;
+	int rc = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "F:S:C:s:b:p:z:m:c:t:o:jh",
+			bench_options, NULL)) != -1) {
+		switch (opt) {
+			case 'F':
+				o_flasher = optarg;
+				break;
+			case 'S':
+				o_sim = optarg;
+				break;
+			case 'C':
+				rc |= parse_commands(optarg);
+				break;
+			case 's':
+				rc |= parse_matrix(&sizes, optarg);
+				break;
+			case 'b':
+				rc |= parse_matrix(&baudrates, optarg);
+				break;
+			case 'p':
+				rc |= parse_matrix(&packet_sizes, optarg);
+				break;
+			case 'z':
+				rc |= parse_matrix(&blanks, optarg);
+				break;
+			case 'm':
+				o_max_wire = strtod(optarg, NULL);
+				break;
+			case 'c':
+				o_baseline = optarg;
+				break;
+			case 't':
+				o_threshold = strtod(optarg, NULL);
+				break;
+			case 'o':
+				o_output = optarg;
+				break;
+			case 'j':
+				o_json = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (rc) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (o_baseline && load_baseline(o_baseline, &base)) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (o_output && (out = fopen(o_output, "w")) == NULL) {
+		printf("ERROR: cannot open %s: %s\n", o_output, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (o_json) {
+		fprintf(out, "[\n");
+	} else {
+		fprintf(out, "cmd,size,baudrate,packet_size,blank,wall_s,bytes_per_s,"
+				"round_trips,syscalls_per_kb,rc%s\n",
+				o_baseline ? ",baseline_bytes_per_s,change_pct" : "");
+	}
+
+	for (int c=0; c<BENCH_CMDS; c++)
+	for (int s=0; s<sizes.count; s++)
+	for (int b=0; b<baudrates.count; b++)
+	for (int p=0; p<packet_sizes.count; p++)
+	for (int z=0; z<blanks.count; z++) {
+		struct result r = {
+			.cmd = c,
+			.size = sizes.values[s],
+			.baudrate = baudrates.values[b],
+			.packet_size = packet_sizes.values[p],
+			.blank = blanks.values[z],
+		};
+		struct result *ref;
+
+		if (!o_commands[c]) {
+			continue;
+		}
+		if (c != BENCH_PROG) {
+			/* packet size and blank ratio only apply to prog */
+			if (p || z) {
+				continue;
+			}
+			r.packet_size = 0;
+			r.blank = 0;
+		}
+		if (c == BENCH_INFO) {
+			if (s) {
+				continue;
+			}
+			r.size = 0;
+		}
+		if (c == BENCH_PROG && r.size * (100 - r.blank) / 100.0 * 10
+				/ r.baudrate > o_max_wire) {
+			continue;
+		}
+
+		if (run_one(&r)) {
+			rc = 1;
+			continue;
+		}
+		if (r.rc) {
+			fprintf(stderr, "FAILED: %s size %lu baudrate %lu packet size %lu "
+					"blank %lu\n", cmd_names[c], r.size, r.baudrate,
+					r.packet_size, r.blank);
+			rc = 1;
+		}
+
+		ref = find_baseline(&base, &r);
+		if (ref && (1 - ref->wall / r.wall) * 100 > o_threshold) {
+			fprintf(stderr, "REGRESSION: %s size %lu baudrate %lu packet size %lu "
+					"blank %lu: %.3f s, baseline %.3f s\n", cmd_names[c],
+					r.size, r.baudrate, r.packet_size, r.blank, r.wall,
+					ref->wall);
+			regressions++;
+		}
+
+		print_result(out, &r, ref, first);
+		fflush(out);
+		first = false;
+	}
+
+	if (o_json) {
+		fprintf(out, "\n]\n");
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	free(base.results);
+
+	return rc || regressions ? EXIT_FAILURE : 0;
+}
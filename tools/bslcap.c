@@ -0,0 +1,465 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+/*
+ * Analyzer for the wire capture written by mspm0flash --capture. Splits
+ * the session into round trips and reports where the time went:
+ *
+ *   wire       bytes on the link at the captured baudrate
+ *   think      device time between the end of the request and the
+ *              first response byte
+ *   turnaround host time between a response and the next request
+ *
+ * With --replay the captured requests are sent again to a serial device,
+ * usually tools/bslsim, with the captured host turnaround in between, so
+ * that a slow session can be reproduced and analyzed the same way.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsl.h"
+#include "capture.h"
+#include "stats.h"
+#include "trace.h"
+#include "transport.h"
+
+struct xfer {
+	uint8_t cmd;
+	uint8_t *tx;
+	uint32_t tx_len;
+	uint8_t *rx;
+	uint32_t rx_len;
+	int32_t error;
+	uint32_t baudrate;	/* link speed of the round trip */
+	uint32_t new_baudrate;	/* link speed change after it, 0 = none */
+	uint64_t t_tx;
+	uint64_t t_done;	/* 0 if not captured */
+	uint64_t t_first;	/* 0 if not captured */
+	uint64_t t_rx;
+};
+
+struct session {
+	char device[64];
+	struct xfer *xfers;
+	size_t count;
+};
+
+/* used by DEBUG() in the linked transport */
+int verbosity = 0;
+
+static bool o_list = false;
+static double o_gap_us = 1000;
+static char *o_replay_device = NULL;
+
+static void session_free(struct session *s)
+{
+	for (size_t i=0; i<s->count; i++) {
+		free(s->xfers[i].tx);
+		free(s->xfers[i].rx);
+	}
+	free(s->xfers);
+}
+
+static int load(const char *filename, struct session *s)
+{
+	struct capture_file_header hdr;
+	struct capture_record r;
+	struct xfer *x = NULL;
+	uint32_t baudrate;
+	uint8_t *data;
+	int rc = 0;
+	FILE *f;
+
+	memset(s, 0, sizeof(*s));
+
+	if ((f = fopen(filename, "r")) == NULL) {
+		printf("ERROR: cannot open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+			|| memcmp(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic))) {
+		printf("ERROR: %s is not a capture file\n", filename);
+		fclose(f);
+		return -1;
+	}
+	hdr.device[sizeof(hdr.device) - 1] = '\0';
+	memcpy(s->device, hdr.device, sizeof(s->device));
+	baudrate = hdr.baudrate;
+
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		data = NULL;
+		if (r.len) {
+			if (r.len > 0x10000 || (data = malloc(r.len)) == NULL
+					|| fread(data, r.len, 1, f) != 1) {
+				free(data);
+				rc = -1;
+				break;
+			}
+		}
+
+		if (r.type == CAPTURE_TX) {
+			struct xfer *xfers;
+
+			xfers = realloc(s->xfers, (s->count + 1) * sizeof(*xfers));
+			if (!xfers) {
+				free(data);
+				rc = -1;
+				break;
+			}
+			s->xfers = xfers;
+			x = &s->xfers[s->count++];
+			memset(x, 0, sizeof(*x));
+			x->cmd = r.len > 3 ? data[3] : 0;
+			x->tx = data;
+			x->tx_len = r.len;
+			x->baudrate = baudrate;
+			x->t_tx = x->t_rx = r.timestamp;
+			continue;
+		}
+
+		if (r.type == CAPTURE_BAUDRATE && r.len == sizeof(uint32_t)) {
+			memcpy(&baudrate, data, sizeof(baudrate));
+			if (x) {
+				x->new_baudrate = baudrate;
+			}
+		} else if (!x) {
+			/* a response without request, ignore */
+		} else if (r.type == CAPTURE_TX_DONE) {
+			x->t_done = r.timestamp;
+		} else if (r.type == CAPTURE_RX_FIRST) {
+			x->t_first = r.timestamp;
+		} else if (r.type == CAPTURE_RX) {
+			x->rx = data;
+			x->rx_len = r.len;
+			x->t_rx = r.timestamp;
+			data = NULL;
+		} else if (r.type == CAPTURE_ERROR && r.len == sizeof(int32_t)) {
+			memcpy(&x->error, data, sizeof(x->error));
+			x->t_rx = r.timestamp;
+		}
+		free(data);
+	}
+
+	if (rc || ferror(f)) {
+		printf("ERROR: %s is truncated\n", filename);
+	}
+	fclose(f);
+
+	return 0;
+}
+
+/* wire time of len bytes, 8n1, unknown for I2C */
+static uint64_t wire_ns(const struct xfer *x, uint32_t len)
+{
+	if (!x->baudrate) {
+		return 0;
+	}
+	return (uint64_t)len * 10 * 1000000000 / x->baudrate;
+}
+
+static uint64_t think_ns(const struct xfer *x)
+{
+	uint64_t start, first;
+
+	/*
+	 * The request is on the wire wire_ns() after the write started, or
+	 * when the transport is done with it if that was later. The first
+	 * response byte needs one byte time to arrive.
+	 */
+	start = x->t_tx + wire_ns(x, x->tx_len);
+	if (x->t_done > start) {
+		start = x->t_done;
+	}
+	if (x->t_first) {
+		first = x->t_first - wire_ns(x, 1);
+	} else {
+		first = x->t_rx - wire_ns(x, x->rx_len);
+	}
+
+	return first > start ? first - start : 0;
+}
+
+static void analyze(const struct session *s)
+{
+	struct {
+		unsigned int count;
+		uint64_t tx_bytes, rx_bytes;
+		uint64_t think, turnaround, response;
+	} cmds[256];
+	uint64_t elapsed, wire = 0, think = 0, turnaround = 0;
+	uint64_t gap_ns = o_gap_us * 1000;
+	unsigned int gaps = 0, errors = 0;
+	uint64_t gap_total = 0;
+
+	if (s->count == 0) {
+		printf("%s: empty capture\n", s->device);
+		return;
+	}
+
+	memset(cmds, 0, sizeof(cmds));
+
+	if (o_list) {
+		printf("%12s %-16s %6s %6s %10s %10s %10s\n", "time us", "command",
+				"tx", "rx", "wire us", "think us", "host us");
+	}
+
+	for (size_t i=0; i<s->count; i++) {
+		const struct xfer *x = &s->xfers[i];
+		uint64_t w = wire_ns(x, x->tx_len) + wire_ns(x, x->rx_len);
+		uint64_t t = think_ns(x);
+		uint64_t host = 0;
+
+		if (i > 0 && x->t_tx > s->xfers[i - 1].t_rx) {
+			host = x->t_tx - s->xfers[i - 1].t_rx;
+		}
+
+		cmds[x->cmd].count++;
+		cmds[x->cmd].tx_bytes += x->tx_len;
+		cmds[x->cmd].rx_bytes += x->rx_len;
+		cmds[x->cmd].think += t;
+		cmds[x->cmd].turnaround += host;
+		cmds[x->cmd].response += x->t_rx - x->t_tx;
+
+		wire += w;
+		think += t;
+		turnaround += host;
+		errors += x->error != 0;
+
+		if (o_list) {
+			printf("%12.1f %-16s %6u %6u %10.1f %10.1f %10.1f%s\n",
+					(x->t_tx - s->xfers[0].t_tx) / 1e3,
+					trace_cmd_name(x->cmd), x->tx_len, x->rx_len,
+					w / 1e3, t / 1e3, host / 1e3,
+					x->error ? " error" : "");
+		}
+		if (host > gap_ns) {
+			gaps++;
+			gap_total += host;
+			if (!o_list) {
+				printf("idle gap of %.1f us before %s at %.1f us\n",
+						host / 1e3, trace_cmd_name(x->cmd),
+						(x->t_tx - s->xfers[0].t_tx) / 1e3);
+			}
+		}
+	}
+
+	elapsed = s->xfers[s->count - 1].t_rx - s->xfers[0].t_tx;
+
+	printf("%s: %zu round trips, %u errors, %.3f s\n", s->device, s->count,
+			errors, elapsed / 1e9);
+	printf("%-16s %6s %10s %10s %12s %12s %12s\n", "command", "count",
+			"tx bytes", "rx bytes", "think us", "host us", "response us");
+	for (int i=0; i<256; i++) {
+		unsigned int n = cmds[i].count;
+
+		if (!n) {
+			continue;
+		}
+		printf("%-16s %6u %10ju %10ju %12.1f %12.1f %12.1f\n",
+				trace_cmd_name(i), n, (uintmax_t)cmds[i].tx_bytes,
+				(uintmax_t)cmds[i].rx_bytes, cmds[i].think / 1e3 / n,
+				cmds[i].turnaround / 1e3 / n, cmds[i].response / 1e3 / n);
+	}
+
+	printf("wire %.3f s, device think %.3f s, host turnaround %.3f s, "
+			"other %.3f s\n", wire / 1e9, think / 1e9, turnaround / 1e9,
+			(elapsed > wire + think + turnaround
+				? elapsed - wire - think - turnaround : 0) / 1e9);
+	printf("idle gaps over %.0f us: %u, %.3f s\n", o_gap_us, gaps,
+			gap_total / 1e9);
+	if (wire && elapsed) {
+		/* achievable: without the host turnaround between round trips */
+		printf("link utilization %.1f%%, achievable %.1f%%\n",
+				100.0 * wire / elapsed,
+				100.0 * wire / (elapsed - turnaround));
+	} else {
+		printf("link utilization unknown, no baudrate\n");
+	}
+}
+
+static int sleep_until(uint64_t t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000;
+	ts.tv_nsec = t % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+
+	return 0;
+}
+
+/*
+ * Send the captured requests to device and record the responses in the
+ * session, keeping the captured host turnaround between round trips.
+ */
+static int replay(struct session *s, const char *device)
+{
+	struct bsl_intf intf = {0};
+	uint8_t rx[0x10000];
+	unsigned int mismatches = 0, errors = 0;
+	uint64_t prev_rx = 0, captured_rx = 0;
+	int rc;
+
+	intf.transport = &uart_transport;
+	intf.timestamps = true;
+
+	if (intf.transport->open(&intf, device) != 0) {
+		printf("ERROR: cannot open device %s\n", device);
+		return -1;
+	}
+	if (intf.transport->configure(&intf) != 0) {
+		intf.transport->close(&intf);
+		return -1;
+	}
+	if (s->count && s->xfers[0].baudrate != intf.baudrate
+			&& intf.transport->set_speed(&intf, s->xfers[0].baudrate) != 0) {
+		intf.transport->close(&intf);
+		return -1;
+	}
+
+	for (size_t i=0; i<s->count; i++) {
+		struct xfer *x = &s->xfers[i];
+		uint32_t read_len = x->rx_len;
+		uint64_t host = 0;
+		bool core;
+
+		/* the session is overwritten with the replay as it goes */
+		if (i > 0 && x->t_tx > captured_rx) {
+			host = x->t_tx - captured_rx;
+		}
+		captured_rx = x->t_rx;
+		if (prev_rx) {
+			sleep_until(prev_rx + host);
+		}
+
+		core = bsl_core_response(x->cmd);
+
+		intf.t_written = 0;
+		intf.t_first_rx = 0;
+		x->t_tx = stats_now();
+		rc = intf.transport->write_read(&intf, x->tx, x->tx_len,
+				rx, sizeof(rx), &read_len, core);
+		x->t_rx = prev_rx = stats_now();
+		x->t_done = intf.t_written;
+		x->t_first = intf.t_first_rx;
+
+		if (rc) {
+			errors++;
+			read_len = 0;
+		}
+		if (!x->error && (rc || read_len != x->rx_len
+				|| memcmp(rx, x->rx, read_len))) {
+			mismatches++;
+		}
+		x->error = rc;
+		x->rx_len = read_len;
+		free(x->rx);
+		x->rx = malloc(read_len ? read_len : 1);
+		if (x->rx) {
+			memcpy(x->rx, rx, read_len);
+		}
+
+		if (!rc && x->new_baudrate
+				&& intf.transport->set_speed(&intf, x->new_baudrate) != 0) {
+			intf.transport->close(&intf);
+			return -1;
+		}
+	}
+
+	intf.transport->close(&intf);
+
+	printf("replayed %zu round trips to %s, %u errors, %u responses differ\n",
+			s->count, device, errors, mismatches);
+
+	return 0;
+}
+
+static void usage(char *self)
+{
+	printf(
+"Usage: %s [options] <capture-file>...\n"
+"\n"
+"  -l, --list              Print every round trip.\n"
+"  -g, --gap US            Report host idle gaps longer than US\n"
+"                          microseconds (default 1000).\n"
+"  -r, --replay DEVICE     Send the captured requests to the serial\n"
+"                          DEVICE, e.g. a tools/bslsim terminal, and\n"
+"                          analyze the replayed session.\n"
+"  -h, --help              Display this help and exit.\n"
+"\n",
+		self);
+}
+
+static struct option cap_options[] = {
+	{ "list",         no_argument,        NULL,   'l'},
+	{ "gap",          required_argument,  NULL,   'g'},
+	{ "replay",       required_argument,  NULL,   'r'},
+	{ "help",         no_argument,        NULL,   'h'},
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	struct session s;
+	int rc = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "lg:r:h", cap_options, NULL)) != -1) {
+		switch (opt) {
+			case 'l':
+				o_list = true;
+				break;
+			case 'g':
+				o_gap_us = strtod(optarg, NULL);
+				break;
+			case 'r':
+				o_replay_device = optarg;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i=optind; i<argc; i++) {
+		if (load(argv[i], &s) != 0) {
+			rc = 1;
+			continue;
+		}
+
+		analyze(&s);
+		if (o_replay_device) {
+			if (replay(&s, o_replay_device) != 0) {
+				rc = 1;
+			} else {
+				analyze(&s);
+			}
+		}
+		session_free(&s);
+	}
+
+	return rc;
+}
@@ -0,0 +1,695 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+/*
+ * Simulated MSPM0 BSL behind a pseudo terminal. Speaks the UART frame
+ * protocol of bsl.c against an in-memory flash so that mspm0flash can be
+ * run and timed without hardware:
+ *
+ *   $ tools/bslsim &
+ *   /dev/pts/5
+ *   $ mspm0flash -n -S /dev/pts/5 prog fw.bin
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/select.h>
+
+#include "bsl.h"
+#include "crc32.h"
+
+#define SIM_MAX_BUFFER_SIZE 0x6c0
+
+struct sim_timing {
+	long byte_ns;		/* wire time per byte, 0 = derive from baudrate */
+	long mass_erase_us;
+	long sector_erase_us;
+	long program_us;	/* per 8 byte flash word */
+	long verify_us;		/* per 1k */
+};
+
+static size_t o_flash_size = 128 * 1024;
+static uint16_t o_max_buffer_size = SIM_MAX_BUFFER_SIZE;
+static bool o_realtime = true;
+static unsigned long o_nak_every = 0;
+static uint32_t o_max_baudrate = 0;
+static unsigned long o_corrupt_every = 0;
+static unsigned long o_flip_every = 0;
+static unsigned long program_count = 0;
+static int verbosity = 0;
+
+static struct sim_timing timing = {
+	.byte_ns = 0,
+	.mass_erase_us = 20000,
+	.sector_erase_us = 4000,
+	.program_us = 40,
+	.verify_us = 50,
+};
+
+static volatile sig_atomic_t stop = 0;
+
+/* printed on exit with --stats */
+static bool o_stats = false;
+static struct {
+	unsigned long frames;
+	unsigned long rx_bytes;
+	unsigned long tx_bytes;
+} stats;
+
+static uint8_t *flash;
+static bool unlocked = false;
+static uint32_t baudrate = 9600;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+
+	if (!o_realtime) {
+		return;
+	}
+
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		if (stop) {
+			break;
+		}
+	}
+}
+
+static uint64_t wire_ns(size_t bytes)
+{
+	long byte_ns = timing.byte_ns;
+
+	if (byte_ns == 0) {
+		/* 8n1 */
+		byte_ns = 10 * 1000000000L / baudrate;
+	}
+	return (uint64_t)bytes * byte_ns;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+struct response {
+	uint8_t buf[8 + 0x10000];
+	size_t len;
+};
+
+static void rsp_ack(struct response *rsp, uint8_t ack)
+{
+	rsp->buf[0] = ack;
+	rsp->len = 1;
+}
+
+static void rsp_core(struct response *rsp, const uint8_t *data, size_t len)
+{
+	uint8_t *p = rsp->buf;
+
+	p[0] = BSL_ACK;
+	p[1] = 0x08;
+	p[2] = len & 0xff;
+	p[3] = (len >> 8) & 0xff;
+	memcpy(&p[4], data, len);
+	put_le32(&p[4 + len], crc32(&p[4], len));
+	rsp->len = 4 + len + BSL_CRC_SIZE;
+}
+
+static void rsp_message(struct response *rsp, uint8_t msg)
+{
+	uint8_t data[2] = { BSL_CORE_RSP_MESSAGE, msg };
+
+	rsp_core(rsp, data, sizeof(data));
+}
+
+static bool range_valid(uint32_t address, uint32_t len)
+{
+	return address <= o_flash_size && len <= o_flash_size - address;
+}
+
+static int uart_speed(uint8_t code, uint32_t *rate)
+{
+	static const uint32_t rates[] = {
+		[BSL_UART_B4800] = 4800,
+		[BSL_UART_B9600] = 9600,
+		[BSL_UART_B19200] = 19200,
+		[BSL_UART_B38400] = 38400,
+		[BSL_UART_B57600] = 57600,
+		[BSL_UART_B115200] = 115200,
+		[BSL_UART_B1000000] = 1000000,
+	};
+
+	if (code < BSL_UART_B4800 || code > BSL_UART_B1000000) {
+		return -1;
+	}
+	*rate = rates[code];
+	return 0;
+}
+
+/*
+ * Program data command, returns the core message and sets the programming
+ * time in microseconds.
+ */
+static uint8_t program(const uint8_t *cmd, size_t len, long *op_us)
+{
+	uint32_t address, count;
+
+	*op_us = 0;
+	if (len < 5) {
+		return BSL_CORE_MSG_INVALID_COMMAND;
+	}
+	address = get_le32(&cmd[1]);
+	count = len - 5;
+	if (address % 8 || count % 8) {
+		return BSL_CORE_MSG_INVALID_ADDRESS;
+	}
+	if (!range_valid(address, count)) {
+		return BSL_CORE_MSG_INVALID_MEMORY_RAMGE;
+	}
+	/* NOR flash can only clear bits */
+	for (uint32_t i=0; i<count; i++) {
+		flash[address + i] &= cmd[5 + i];
+	}
+	if (o_flip_every && ++program_count % o_flip_every == 0) {
+		/* a weak cell, clear one bit too many */
+		for (uint32_t i=0; i<count; i++) {
+			if (flash[address + i]) {
+				flash[address + i] &= flash[address + i] - 1;
+				break;
+			}
+		}
+	}
+	*op_us = timing.program_us * (count / 8);
+
+	return BSL_CORE_MSG_OPERATION_SUCCESSFUL;
+}
+
+/*
+ * Execute one core command. Returns the device side processing time in
+ * microseconds, *background is set if that time does not delay the
+ * response.
+ */
+static long handle_command(const uint8_t *cmd, size_t len,
+		struct response *rsp, uint32_t *new_baudrate, bool *background)
+{
+	uint8_t data[1 + 24];
+	uint32_t address, count;
+	long op_us;
+
+	switch (cmd[0]) {
+		case BSL_CMD_CONNECTION:
+			rsp_ack(rsp, BSL_ACK);
+			return 0;
+
+		case BSL_CMD_GET_DEVICE_INFO:
+			memset(data, 0, sizeof(data));
+			data[0] = BSL_CORE_RSP_GET_DEVICE_INFO;
+			data[1] = 0x01;		/* cmd interpreter version */
+			data[3] = 0x0a;		/* build id */
+			data[9] = 0x01;		/* plug-in interface version */
+			data[11] = o_max_buffer_size & 0xff;
+			data[12] = o_max_buffer_size >> 8;
+			put_le32(&data[13], 0x20000160);
+			put_le32(&data[17], 0x00000001);
+			put_le32(&data[21], 0x00000001);
+			rsp_core(rsp, data, sizeof(data));
+			return 0;
+
+		case BSL_CMD_UNLOCK_BL:
+			if (len != 33) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_COMMAND);
+				return 0;
+			}
+			unlocked = true;
+			for (int i=1; i<33; i++) {
+				if (cmd[i] != 0xff) {
+					unlocked = false;
+				}
+			}
+			rsp_message(rsp, unlocked ? BSL_CORE_MSG_OPERATION_SUCCESSFUL
+					: BSL_CORE_MSG_BSL_PASSWORD_ERROR);
+			return 0;
+
+		case BSL_CMD_CHANGE_BAUDRATE:
+			if (len != 2 || uart_speed(cmd[1], new_baudrate)) {
+				rsp_ack(rsp, BSL_ERROR_UNKNOWN_BAUD_RATE);
+				return 0;
+			}
+			rsp_ack(rsp, BSL_ACK);
+			return 0;
+
+		case BSL_CMD_START_APPLICATION:
+			rsp_ack(rsp, BSL_ACK);
+			unlocked = false;
+			return 0;
+	}
+
+	if (cmd[0] == BSL_CMD_PROGRAM_DATA_FAST) {
+		/* acknowledged on reception, errors are not reported */
+		rsp_ack(rsp, BSL_ACK);
+		if (!unlocked || program(cmd, len, &op_us)) {
+			return 0;
+		}
+		*background = true;
+		return op_us;
+	}
+
+	if (!unlocked) {
+		rsp_message(rsp, BSL_CORE_MSG_BSL_LOCKED_ERROR);
+		return 0;
+	}
+
+	switch (cmd[0]) {
+		case BSL_CMD_MASS_ERASE:
+			memset(flash, 0xff, o_flash_size);
+			rsp_message(rsp, BSL_CORE_MSG_OPERATION_SUCCESSFUL);
+			return timing.mass_erase_us;
+
+		case BSL_CMD_FLASH_RANGE_ERASE: {
+			uint32_t start, end;
+
+			if (len != 9) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_COMMAND);
+				return 0;
+			}
+			start = get_le32(&cmd[1]) & ~(BSL_FLASH_SECTOR_SIZE - 1);
+			end = get_le32(&cmd[5]) | (BSL_FLASH_SECTOR_SIZE - 1);
+			if (end < start || !range_valid(start, end - start + 1)) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_MEMORY_RAMGE);
+				return 0;
+			}
+			memset(flash + start, 0xff, end - start + 1);
+			rsp_message(rsp, BSL_CORE_MSG_OPERATION_SUCCESSFUL);
+			return timing.sector_erase_us
+				* ((end - start + 1) / BSL_FLASH_SECTOR_SIZE);
+		}
+
+		case BSL_CMD_PROGRAM_DATA:
+			rsp_message(rsp, program(cmd, len, &op_us));
+			return op_us;
+
+		case BSL_CMD_MEMORY_READ_BACK: {
+			static uint8_t buf[1 + 0x10000];
+
+			if (len != 9) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_COMMAND);
+				return 0;
+			}
+			address = get_le32(&cmd[1]);
+			count = get_le32(&cmd[5]);
+			if (!range_valid(address, count) || count > o_max_buffer_size) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_MEMORY_RAMGE);
+				return 0;
+			}
+			buf[0] = BSL_CORE_RSP_MEMORY_READ_BACK;
+			memcpy(&buf[1], flash + address, count);
+			rsp_core(rsp, buf, 1 + count);
+			return 0;
+		}
+
+		case BSL_CMD_STANDALONE_VERIFICATION:
+			if (len != 9) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_COMMAND);
+				return 0;
+			}
+			address = get_le32(&cmd[1]);
+			count = get_le32(&cmd[5]);
+			if (count < BSL_VERIFICATION_BLOCK_SIZE) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_LENGTH);
+				return 0;
+			}
+			if (!range_valid(address, count)) {
+				rsp_message(rsp, BSL_CORE_MSG_INVALID_MEMORY_RAMGE);
+				return 0;
+			}
+			data[0] = BSL_CORE_RSP_STANDALONE_VERIFICATION;
+			put_le32(&data[1], crc32(flash + address, count));
+			rsp_core(rsp, data, 5);
+			return timing.verify_us * (count / 1024);
+	}
+
+	rsp_message(rsp, BSL_CORE_MSG_UNKNOWN_COMMAND);
+	return 0;
+}
+
+/*
+ * Feed received bytes into the frame assembler. Returns the number of bytes
+ * consumed once a complete frame was handled, 0 if more data is needed.
+ */
+static size_t handle_frame(int fd, uint8_t *buf, size_t len, uint64_t start)
+{
+	static struct response rsp;
+	/* end of a programming operation which runs after its ACK */
+	static uint64_t busy_until;
+	uint32_t new_baudrate = 0;
+	size_t frame_len, core_len;
+	uint64_t deadline;
+	bool background = false;
+	long op_us = 0;
+
+	if (buf[0] != BSL_CMD_HEADER) {
+		rsp_ack(&rsp, BSL_ERROR_HEADER_INCORRECT);
+		frame_len = 1;
+		goto respond;
+	}
+
+	if (len < BSL_HEADER_SIZE) {
+		return 0;
+	}
+
+	core_len = buf[1] | buf[2] << 8;
+	if (core_len == 0) {
+		rsp_ack(&rsp, BSL_ERROR_PACKET_SIZE_ZERO);
+		frame_len = BSL_HEADER_SIZE;
+		goto respond;
+	}
+	if (core_len > o_max_buffer_size) {
+		rsp_ack(&rsp, BSL_ERROR_PACKET_SIZE_TOO_BIG);
+		frame_len = BSL_HEADER_SIZE;
+		goto respond;
+	}
+
+	frame_len = BSL_HEADER_SIZE + core_len + BSL_CRC_SIZE;
+	if (len < frame_len) {
+		return 0;
+	}
+
+	if (crc32(&buf[3], core_len) != get_le32(&buf[3 + core_len])
+			|| (o_nak_every && (stats.frames + 1) % o_nak_every == 0)) {
+		rsp_ack(&rsp, BSL_ERROR_CHECKSUM_INCORRECT);
+		goto respond;
+	}
+
+	op_us = handle_command(&buf[3], core_len, &rsp, &new_baudrate,
+			&background);
+
+	if (verbosity) {
+		fprintf(stderr, "cmd 0x%02x len %zu -> %zu bytes, %ld us\n",
+				buf[3], core_len, rsp.len, op_us);
+	}
+
+respond:
+	/* the frame is received while a previous operation is still running */
+	deadline = start + wire_ns(frame_len);
+	if (deadline < busy_until) {
+		deadline = busy_until;
+	}
+	if (background) {
+		busy_until = deadline + op_us * 1000;
+		op_us = 0;
+	}
+	deadline += op_us * 1000 + wire_ns(rsp.len);
+	sleep_until(deadline);
+
+	if ((o_max_baudrate && baudrate > o_max_baudrate)
+			|| (o_corrupt_every && (stats.frames + 1) % o_corrupt_every == 0)) {
+		/* a link which is too fast for the cable or noise */
+		rsp.buf[rsp.len - 1] ^= 0x55;
+	}
+
+	if (write_all(fd, rsp.buf, rsp.len)) {
+		perror("write");
+	}
+
+	stats.frames++;
+	stats.rx_bytes += frame_len;
+	stats.tx_bytes += rsp.len;
+
+	if (new_baudrate) {
+		baudrate = new_baudrate;
+	}
+
+	return frame_len;
+}
+
+static int open_pty(int *slave)
+{
+	struct termios tio;
+	int master;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		perror("posix_openpt");
+		return -1;
+	}
+
+	/* keep the slave open so the master survives client reconnects */
+	*slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror("open slave");
+		return -1;
+	}
+
+	tcgetattr(*slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(*slave, TCSANOW, &tio);
+
+	return master;
+}
+
+static void usage(char *self)
+{
+	printf(
+"Usage: %s [options]\n"
+"\n"
+"  Simulated MSPM0 BSL on a pseudo terminal. The slave device name is\n"
+"  printed on stdout.\n"
+"\n"
+"  Options:\n"
+"  -f, --flash-size SIZE       Flash size in bytes (default 131072)\n"
+"  -B, --buffer-size SIZE      Reported BSL max buffer size (default 0x6c0)\n"
+"  -w, --byte-time NS          Wire time per byte (default from baudrate)\n"
+"  -N, --no-delay              Do not simulate any wire or flash timing\n"
+"      --mass-erase-us US      Mass erase time (default 20000)\n"
+"      --sector-erase-us US    Sector erase time (default 4000)\n"
+"      --program-us US         Program time per 8 bytes (default 40)\n"
+"      --verify-us US          Verification time per 1k (default 50)\n"
+"      --nak-every N           Reject every Nth frame with a checksum error\n"
+"      --max-baudrate RATE     Corrupt the responses above RATE\n"
+"      --corrupt-every N       Corrupt every Nth response\n"
+"      --flip-every N          Program one wrong bit with every Nth\n"
+"                              program data command\n"
+"  -s, --stats                 Print frame and byte counts on exit\n"
+"  -v, --verbose               Log every command on stderr\n"
+"  -h, --help                  Display this help and exit.\n"
+"\n",
+		self);
+}
+
+enum {
+	OPT_MASS_ERASE_US = 0x100,
+	OPT_SECTOR_ERASE_US,
+	OPT_PROGRAM_US,
+	OPT_VERIFY_US,
+	OPT_NAK_EVERY,
+	OPT_MAX_BAUDRATE,
+	OPT_CORRUPT_EVERY,
+	OPT_FLIP_EVERY,
+};
+
+static struct option sim_options[] = {
+	{ "flash-size",      required_argument,  NULL,   'f'},
+	{ "buffer-size",     required_argument,  NULL,   'B'},
+	{ "byte-time",       required_argument,  NULL,   'w'},
+	{ "no-delay",        no_argument,        NULL,   'N'},
+	{ "mass-erase-us",   required_argument,  NULL,   OPT_MASS_ERASE_US},
+	{ "sector-erase-us", required_argument,  NULL,   OPT_SECTOR_ERASE_US},
+	{ "program-us",      required_argument,  NULL,   OPT_PROGRAM_US},
+	{ "verify-us",       required_argument,  NULL,   OPT_VERIFY_US},
+	{ "nak-every",       required_argument,  NULL,   OPT_NAK_EVERY},
+	{ "max-baudrate",    required_argument,  NULL,   OPT_MAX_BAUDRATE},
+	{ "corrupt-every",   required_argument,  NULL,   OPT_CORRUPT_EVERY},
+	{ "flip-every",      required_argument,  NULL,   OPT_FLIP_EVERY},
+	{ "stats",           no_argument,        NULL,   's'},
+	{ "verbose",         no_argument,        NULL,   'v'},
+	{ "help",            no_argument,        NULL,   'h'},
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	static uint8_t buf[2 * 0x10000];
+	struct sigaction sa;
+	size_t len = 0;
+	uint64_t start = 0;
+	int master, slave;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "f:B:w:Nsvh",
+			sim_options, NULL)) != -1) {
+		switch (opt) {
+			case 'f':
+				o_flash_size = strtoul(optarg, NULL, 0);
+				break;
+			case 'B':
+				o_max_buffer_size = strtoul(optarg, NULL, 0);
+				break;
+			case 'w':
+				timing.byte_ns = strtol(optarg, NULL, 0);
+				break;
+			case 'N':
+				o_realtime = false;
+				break;
+			case OPT_MASS_ERASE_US:
+				timing.mass_erase_us = strtol(optarg, NULL, 0);
+				break;
+			case OPT_SECTOR_ERASE_US:
+				timing.sector_erase_us = strtol(optarg, NULL, 0);
+				break;
+			case OPT_PROGRAM_US:
+				timing.program_us = strtol(optarg, NULL, 0);
+				break;
+			case OPT_VERIFY_US:
+				timing.verify_us = strtol(optarg, NULL, 0);
+				break;
+			case OPT_NAK_EVERY:
+				o_nak_every = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_MAX_BAUDRATE:
+				o_max_baudrate = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_CORRUPT_EVERY:
+				o_corrupt_every = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_FLIP_EVERY:
+				o_flip_every = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				o_stats = true;
+				break;
+			case 'v':
+				verbosity++;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (o_flash_size == 0 || o_flash_size % BSL_FLASH_SECTOR_SIZE) {
+		printf("ERROR: flash size must be a multiple of %d\n",
+				BSL_FLASH_SECTOR_SIZE);
+		exit(EXIT_FAILURE);
+	}
+
+	flash = malloc(o_flash_size);
+	if (!flash) {
+		printf("ERROR: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(flash, 0xff, o_flash_size);
+
+	master = open_pty(&slave);
+	if (master < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("%s\n", ptsname(master));
+	fflush(stdout);
+
+	while (!stop) {
+		ssize_t n;
+		size_t used;
+
+		n = read(master, buf + len, sizeof(buf) - len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EIO) {
+				continue;
+			}
+			perror("read");
+			break;
+		}
+		if (len == 0) {
+			start = now_ns();
+		}
+		len += n;
+
+		while (len > 0 && (used = handle_frame(master, buf, len, start)) > 0) {
+			memmove(buf, buf + used, len - used);
+			len -= used;
+			start = now_ns();
+		}
+
+		if (len == sizeof(buf)) {
+			/* garbage, resync */
+			len = 0;
+		}
+	}
+
+	if (o_stats) {
+		printf("frames=%lu rx_bytes=%lu tx_bytes=%lu\n",
+				stats.frames, stats.rx_bytes, stats.tx_bytes);
+	}
+
+	close(slave);
+	close(master);
+	free(flash);
+
+	return 0;
+}
@@ -0,0 +1,474 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+/*
+ * Microbenchmark for the host side hot paths of mspm0flash. The BSL
+ * commands run against a loopback transport which answers every frame
+ * with a canned response, so only the host CPU time per packet is
+ * measured: frame construction, add_crc(), the response checks and the
+ * response CRC.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "bsl.h"
+#include "crc32.h"
+#include "image.h"
+#include "transport.h"
+
+#define MAX_REPETITIONS 100
+
+int verbosity = 0;
+
+static size_t o_size = 512 * 1024;
+static size_t o_packet_size = 1712;
+static int o_repetitions = 5;
+static double o_min_time = 0.1;
+static const char *o_filter = NULL;
+
+struct bench {
+	const char *name;
+	size_t bytes;
+	int (*run)(void *arg);
+	void *arg;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_CYCLES
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Runs the benchmark once for o_min_time to warm up caches, branch
+ * predictors and the CPU frequency, then o_repetitions times for at least
+ * o_min_time each. Prints min, median, mean and standard deviation of the
+ * time per operation.
+ */
+static int bench_run(struct bench *b)
+{
+	double ns[MAX_REPETITIONS];
+	double cyc[MAX_REPETITIONS];
+	double mean = 0, sd = 0;
+
+	if (o_filter && !strstr(b->name, o_filter)) {
+		return 0;
+	}
+
+	for (int r=-1; r<o_repetitions; r++) {
+		double start, elapsed;
+		uint64_t c0, c1;
+		size_t iterations = 0;
+
+		start = now();
+		c0 = cycles();
+		do {
+			if (b->run(b->arg)) {
+				printf("  %-24s FAILED\n", b->name);
+				return 1;
+			}
+			iterations++;
+			elapsed = now() - start;
+		} while (elapsed < o_min_time);
+		c1 = cycles();
+
+		/* warmup */
+		if (r < 0) {
+			continue;
+		}
+
+		ns[r] = elapsed * 1e9 / iterations;
+		cyc[r] = (double)(c1 - c0) / iterations;
+	}
+
+	for (int r=0; r<o_repetitions; r++) {
+		mean += ns[r];
+	}
+	mean /= o_repetitions;
+	for (int r=0; r<o_repetitions; r++) {
+		sd += (ns[r] - mean) * (ns[r] - mean);
+	}
+	sd = sqrt(sd / o_repetitions);
+
+	qsort(ns, o_repetitions, sizeof(double), cmp_double);
+	qsort(cyc, o_repetitions, sizeof(double), cmp_double);
+
+	printf("  %-24s %8zu %12.1f %12.1f %12.1f %9.1f", b->name, b->bytes,
+			ns[0], ns[o_repetitions / 2], mean, sd);
+#ifdef HAVE_CYCLES
+	printf(" %9.3f", cyc[o_repetitions / 2] / b->bytes);
+#else
+	printf(" %9s", "n/a");
+#endif
+	printf(" %9.1f\n", b->bytes / ns[0] * 1e3);
+
+	return 0;
+}
+
+static void bench_header(const char *title)
+{
+	printf("\n%s\n", title);
+	printf("  %-24s %8s %12s %12s %12s %9s %9s %9s\n", "", "bytes",
+			"min ns/op", "median", "mean", "stddev", "cyc/byte", "MB/s");
+}
+
+static uint8_t *pattern(size_t len)
+{
+	uint8_t *buf;
+
+	buf = malloc(len);
+	if (!buf) {
+		printf("ERROR: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i=0; i<len; i++) {
+		buf[i] = i * 7 + (i >> 8);
+	}
+
+	return buf;
+}
+
+struct crc_arg {
+	const struct crc32_impl *impl;
+	const uint8_t *buf;
+	size_t len;
+	volatile uint32_t sink;
+};
+
+static int run_crc32(void *arg)
+{
+	struct crc_arg *a = arg;
+
+	a->sink = a->impl->update(CRC32_INIT, a->buf, a->len);
+
+	return 0;
+}
+
+static int bench_crc32(void)
+{
+	const struct crc32_impl *impl;
+	struct crc_arg arg;
+	int rc = 0;
+
+	arg.buf = pattern(o_size);
+	arg.len = o_size;
+
+	bench_header("crc32");
+	printf("  active: %s\n", crc32_impl_get()->name);
+
+	for (impl = crc32_impls; impl->name; impl++) {
+		struct bench b = { impl->name, o_size, run_crc32, &arg };
+
+		if (!impl->supported()) {
+			printf("  %-24s not supported\n", impl->name);
+			continue;
+		}
+
+		if (crc32_selftest(impl) != 0) {
+			printf("  %-24s SELF-TEST FAILED\n", impl->name);
+			rc = 1;
+			continue;
+		}
+
+		arg.impl = impl;
+		rc |= bench_run(&b);
+	}
+
+	free((void *)arg.buf);
+
+	return rc;
+}
+
+/*
+ * Loopback transport, answers with the response prepared in rsp. The
+ * copy into rx is what a real transport does as well.
+ */
+static uint8_t rsp[32];
+static uint32_t rsp_len;
+
+static void set_response(const uint8_t *core, uint32_t len)
+{
+	uint32_t crc;
+
+	rsp[0] = BSL_ACK;
+	rsp[1] = BSL_RSP_HEADER;
+	rsp[2] = len & 0xff;
+	rsp[3] = (len >> 8) & 0xff;
+	memcpy(&rsp[4], core, len);
+	crc = crc32(core, len);
+	rsp[4 + len] = crc & 0xff;
+	rsp[5 + len] = (crc >> 8) & 0xff;
+	rsp[6 + len] = (crc >> 16) & 0xff;
+	rsp[7 + len] = (crc >> 24) & 0xff;
+	rsp_len = BSL_RSP_HEADER_SIZE + len + BSL_CRC_SIZE;
+}
+
+static int loopback_write_read(struct bsl_intf *intf, uint8_t *tx,
+		uint32_t write_len, uint8_t *rx, uint32_t rx_size,
+		uint32_t *read_len, bool core)
+{
+	(void)intf;
+	(void)tx;
+	(void)write_len;
+
+	*read_len = core ? rsp_len : 1;
+	if (*read_len > rx_size) {
+		return 1;
+	}
+	memcpy(rx, rsp, *read_len);
+
+	return 0;
+}
+
+static const struct bsl_transport loopback_transport = {
+	.name = "loopback",
+	.write_read = loopback_write_read,
+};
+
+struct cmd_arg {
+	struct bsl_intf intf;
+	uint8_t *data;
+	size_t len;
+};
+
+static int run_program_data(void *arg)
+{
+	struct cmd_arg *a = arg;
+
+	return bsl_program_data(&a->intf, 0, a->data, a->len);
+}
+
+static int run_verification(void *arg)
+{
+	struct cmd_arg *a = arg;
+	uint32_t crc;
+
+	return bsl_verification(&a->intf, 0, a->len, &crc);
+}
+
+static int run_connect(void *arg)
+{
+	struct cmd_arg *a = arg;
+
+	return bsl_connect(&a->intf);
+}
+
+static int bench_frames(void)
+{
+	static const uint8_t msg_ok[] = {
+		BSL_CORE_RSP_MESSAGE, BSL_CORE_MSG_OPERATION_SUCCESSFUL
+	};
+	static const uint8_t verify[] = {
+		BSL_CORE_RSP_STANDALONE_VERIFICATION, 0x78, 0x56, 0x34, 0x12
+	};
+	struct cmd_arg arg = {
+		.intf = { .transport = &loopback_transport },
+	};
+	struct bench b;
+	int rc = 0;
+
+	arg.data = pattern(o_packet_size > 256 ? o_packet_size : 256);
+
+	bench_header("BSL commands (loopback)");
+
+	set_response(msg_ok, sizeof(msg_ok));
+	b = (struct bench){ "connect", 8, run_connect, &arg };
+	rc |= bench_run(&b);
+
+	arg.len = 8;
+	b = (struct bench){ "program_data 8", arg.len, run_program_data, &arg };
+	rc |= bench_run(&b);
+
+	arg.len = 256;
+	b = (struct bench){ "program_data 256", arg.len, run_program_data, &arg };
+	rc |= bench_run(&b);
+
+	arg.len = o_packet_size;
+	b = (struct bench){ "program_data max", arg.len, run_program_data, &arg };
+	rc |= bench_run(&b);
+
+	set_response(verify, sizeof(verify));
+	arg.len = BSL_VERIFICATION_BLOCK_SIZE;
+	b = (struct bench){ "verification", 16, run_verification, &arg };
+	rc |= bench_run(&b);
+
+	bsl_release(&arg.intf);
+	free(arg.data);
+
+	return rc;
+}
+
+struct image_arg {
+	char filename[64];
+};
+
+static int run_load_fw_image(void *arg)
+{
+	struct image_arg *a = arg;
+	uint8_t *buf;
+	size_t len;
+	int rc;
+
+	rc = load_fw_image(a->filename, &buf, &len, 0);
+	if (rc == 0) {
+		free(buf);
+	}
+
+	return rc;
+}
+
+static int run_fw_image_load(void *arg)
+{
+	struct image_arg *a = arg;
+	struct fw_image img;
+	int rc;
+
+	rc = fw_image_load(&img, a->filename);
+	if (rc == 0) {
+		fw_image_free(&img);
+	}
+
+	return rc;
+}
+
+static int bench_image(void)
+{
+	struct image_arg arg = { "/tmp/microbench-XXXXXX" };
+	struct bench b;
+	uint8_t *buf;
+	int fd, rc = 0;
+
+	fd = mkstemp(arg.filename);
+	if (fd < 0) {
+		printf("ERROR: cannot create %s\n", arg.filename);
+		return 1;
+	}
+	buf = pattern(o_size);
+	if (write(fd, buf, o_size) != (ssize_t)o_size) {
+		printf("ERROR: cannot write %s\n", arg.filename);
+		rc = 1;
+	}
+	close(fd);
+	free(buf);
+
+	bench_header("image (page cache)");
+
+	if (rc == 0) {
+		b = (struct bench){ "load_fw_image", o_size, run_load_fw_image, &arg };
+		rc |= bench_run(&b);
+
+		b = (struct bench){ "fw_image_load", o_size, run_fw_image_load, &arg };
+		rc |= bench_run(&b);
+	}
+
+	unlink(arg.filename);
+
+	return rc;
+}
+
+static void usage(char *self)
+{
+	printf(
+"Usage: %s [options]\n"
+"\n"
+"  -s, --size BYTES        Buffer and image size (default 524288)\n"
+"  -p, --packet-size BYTES Program data packet size (default 1712)\n"
+"  -r, --repetitions N     Number of repetitions (default 5)\n"
+"  -t, --min-time SEC      Minimum time per repetition (default 0.1)\n"
+"  -f, --filter NAME       Only run the benchmarks containing NAME\n"
+"  -h, --help              Display this help and exit.\n"
+"\n",
+		self);
+}
+
+static struct option bench_options[] = {
+	{ "size",         required_argument,  NULL,   's'},
+	{ "packet-size",  required_argument,  NULL,   'p'},
+	{ "repetitions",  required_argument,  NULL,   'r'},
+	{ "min-time",     required_argument,  NULL,   't'},
+	{ "filter",       required_argument,  NULL,   'f'},
+	{ "help",         no_argument,        NULL,   'h'},
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	int rc = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "s:p:r:t:f:h",
+			bench_options, NULL)) != -1) {
+		switch (opt) {
+			case 's':
+				o_size = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				o_packet_size = strtoul(optarg, NULL, 0);
+				break;
+			case 'r':
+				o_repetitions = strtol(optarg, NULL, 0);
+				break;
+			case 't':
+				o_min_time = strtod(optarg, NULL);
+				break;
+			case 'f':
+				o_filter = optarg;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (o_size == 0 || o_repetitions < 1 || o_repetitions > MAX_REPETITIONS
+			|| o_packet_size == 0 || o_packet_size > BSL_PROGRAM_DATA_LIMIT) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	rc |= bench_crc32();
+	rc |= bench_frames();
+	rc |= bench_image();
+
+	return rc;
+}
@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+/*
+ * Decoder for the frame trace written by mspm0flash --trace.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsl.h"
+#include "trace.h"
+
+static bool o_hex = false;
+
+static const char *ack_name(uint8_t ack)
+{
+	switch (ack) {
+		case BSL_ACK: return "ack";
+		case BSL_ERROR_HEADER_INCORRECT: return "header incorrect";
+		case BSL_ERROR_CHECKSUM_INCORRECT: return "checksum incorrect";
+		case BSL_ERROR_PACKET_SIZE_ZERO: return "packet size zero";
+		case BSL_ERROR_PACKET_SIZE_TOO_BIG: return "packet size too big";
+		case BSL_ERROR_UNKNOWN_ERROR: return "unknown error";
+		case BSL_ERROR_UNKNOWN_BAUD_RATE: return "unknown baudrate";
+		default: return "invalid";
+	}
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* the fields of the frame head which are in the record */
+static void print_details(const struct trace_record *r)
+{
+	const uint8_t *d = r->data;
+	unsigned int n = r->prefix_len;
+
+	if (r->dir == TRACE_TX) {
+		/* 0x80, len16, cmd, arguments */
+		if (n >= 8 && (r->cmd == BSL_CMD_PROGRAM_DATA
+				|| r->cmd == BSL_CMD_PROGRAM_DATA_FAST
+				|| r->cmd == BSL_CMD_FLASH_RANGE_ERASE
+				|| r->cmd == BSL_CMD_STANDALONE_VERIFICATION
+				|| r->cmd == BSL_CMD_MEMORY_READ_BACK)) {
+			printf(" addr=0x%08x", get_le32(&d[4]));
+		}
+		if (n >= 12 && (r->cmd == BSL_CMD_STANDALONE_VERIFICATION
+				|| r->cmd == BSL_CMD_MEMORY_READ_BACK)) {
+			printf(" len=%u", get_le32(&d[8]));
+		}
+		if (n >= 12 && r->cmd == BSL_CMD_FLASH_RANGE_ERASE) {
+			printf(" end=0x%08x", get_le32(&d[8]));
+		}
+		if ((r->cmd == BSL_CMD_PROGRAM_DATA
+				|| r->cmd == BSL_CMD_PROGRAM_DATA_FAST)
+				&& r->len >= 12) {
+			printf(" data=%u", r->len - 12);
+		}
+		return;
+	}
+
+	if (r->status) {
+		printf(" error %u", r->status);
+		return;
+	}
+	if (n < 1) {
+		return;
+	}
+	printf(" %s", ack_name(d[0]));
+	if (n < 5 || d[0] != BSL_ACK) {
+		return;
+	}
+
+	switch (d[4]) {
+		case BSL_CORE_RSP_MESSAGE:
+			if (n >= 6) {
+				printf(" message=0x%02x", d[5]);
+			}
+			break;
+		case BSL_CORE_RSP_STANDALONE_VERIFICATION:
+			if (n >= 9) {
+				printf(" crc=0x%08x", get_le32(&d[5]));
+			}
+			break;
+		case BSL_CORE_RSP_GET_DEVICE_INFO:
+			printf(" device_info");
+			break;
+		case BSL_CORE_RSP_MEMORY_READ_BACK:
+			printf(" readback");
+			break;
+		default:
+			printf(" response=0x%02x", d[4]);
+			break;
+	}
+}
+
+static int dump(const char *filename)
+{
+	struct trace_file_header hdr;
+	struct trace_record r;
+	uint64_t first = 0, prev = 0;
+	FILE *f;
+
+	if ((f = fopen(filename, "r")) == NULL) {
+		printf("ERROR: cannot open %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+			|| memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))
+			|| hdr.record_size != sizeof(r)) {
+		printf("ERROR: %s is not a trace file\n", filename);
+		fclose(f);
+		return 1;
+	}
+
+	hdr.device[sizeof(hdr.device) - 1] = '\0';
+	printf("%s: %u frames", hdr.device, hdr.count);
+	if (hdr.dropped) {
+		printf(", %ju older frames dropped", (uintmax_t)hdr.dropped);
+	}
+	printf("\n%12s %10s  %-3s %-16s %6s\n", "time us", "delta us", "dir",
+			"command", "len");
+
+	for (uint32_t i=0; i<hdr.count; i++) {
+		if (fread(&r, sizeof(r), 1, f) != 1) {
+			printf("ERROR: truncated trace\n");
+			fclose(f);
+			return 1;
+		}
+		if (i == 0) {
+			first = prev = r.timestamp;
+		}
+
+		printf("%12.1f %10.1f  %-3s %-16s %6u", (r.timestamp - first) / 1e3,
+				(r.timestamp - prev) / 1e3, r.dir == TRACE_TX ? "TX" : "RX",
+				trace_cmd_name(r.cmd), r.len);
+		print_details(&r);
+		printf("\n");
+
+		if (o_hex) {
+			printf("%29s", "");
+			for (unsigned int j=0; j<r.prefix_len; j++) {
+				printf(" %02x", r.data[j]);
+			}
+			printf("%s\n", r.prefix_len < r.len ? " ..." : "");
+		}
+		prev = r.timestamp;
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static void usage(char *self)
+{
+	printf(
+"Usage: %s [options] <trace-file>...\n"
+"\n"
+"  -x, --hex               Also print the recorded frame bytes.\n"
+"  -h, --help              Display this help and exit.\n"
+"\n",
+		self);
+}
+
+static struct option dump_options[] = {
+	{ "hex",          no_argument,        NULL,   'x'},
+	{ "help",         no_argument,        NULL,   'h'},
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	int rc = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "xh", dump_options, NULL)) != -1) {
+		switch (opt) {
+			case 'x':
+				o_hex = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i=optind; i<argc; i++) {
+		rc |= dump(argv[i]);
+	}
+
+	return rc;
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsl.h"
+#include "trace.h"
+
+void trace_frame(struct trace *t, uint8_t dir, uint8_t cmd,
+		const uint8_t *buf, uint32_t len, int status)
+{
+	struct trace_record *r = &t->records[t->head++ % TRACE_RECORDS];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	r->timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	r->len = len;
+	r->dir = dir;
+	r->cmd = cmd;
+	r->prefix_len = len < TRACE_PREFIX ? len : TRACE_PREFIX;
+	r->status = status < 0 || status > 0xff ? 0xff : status;
+	memcpy(r->data, buf, r->prefix_len);
+}
+
+int trace_write(const struct trace *t, const char *device,
+		const char *filename)
+{
+	struct trace_file_header hdr;
+	uint64_t first = 0;
+	FILE *f;
+	int rc = 0;
+
+	if (t->head > TRACE_RECORDS) {
+		first = t->head - TRACE_RECORDS;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.record_size = sizeof(struct trace_record);
+	hdr.count = t->head - first;
+	hdr.dropped = first;
+	snprintf(hdr.device, sizeof(hdr.device), "%s", device);
+
+	if ((f = fopen(filename, "w")) == NULL) {
+		printf("ERROR: cannot open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		rc = -1;
+	}
+
+	for (uint64_t i=first; rc == 0 && i<t->head; i++) {
+		if (fwrite(&t->records[i % TRACE_RECORDS],
+				sizeof(struct trace_record), 1, f) != 1) {
+			rc = -1;
+		}
+	}
+
+	if (fclose(f) != 0 || rc) {
+		printf("ERROR: cannot write %s\n", filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+const char *trace_cmd_name(uint8_t cmd)
+{
+	switch (cmd) {
+		case BSL_CMD_CONNECTION: return "connect";
+		case BSL_CMD_GET_DEVICE_INFO: return "device_info";
+		case BSL_CMD_UNLOCK_BL: return "unlock";
+		case BSL_CMD_MASS_ERASE: return "mass_erase";
+		case BSL_CMD_FLASH_RANGE_ERASE: return "range_erase";
+		case BSL_CMD_PROGRAM_DATA: return "program_data";
+		case BSL_CMD_PROGRAM_DATA_FAST: return "program_fast";
+		case BSL_CMD_STANDALONE_VERIFICATION: return "verification";
+		case BSL_CMD_MEMORY_READ_BACK: return "readback";
+		case BSL_CMD_START_APPLICATION: return "start";
+		case BSL_CMD_CHANGE_BAUDRATE: return "change_baudrate";
+		default: return "unknown";
+	}
+}
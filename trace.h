@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/*
+ * Ring of the last TRACE_RECORDS frames of a session. Recording is a
+ * memcpy of the frame head, so it is always enabled. The ring is written
+ * to a file with --trace and decoded offline by tools/tracedump.
+ */
+#define TRACE_RECORDS 1024
+#define TRACE_PREFIX 32
+
+enum {
+	TRACE_TX = 1,
+	TRACE_RX,
+};
+
+struct trace_record {
+	uint64_t timestamp;	/* CLOCK_MONOTONIC in ns */
+	uint32_t len;		/* length of the whole frame */
+	uint8_t dir;
+	uint8_t cmd;		/* command of the request */
+	uint8_t prefix_len;	/* bytes in data */
+	uint8_t status;		/* transfer result of RX records, 0 = ok */
+	uint8_t data[TRACE_PREFIX];
+};
+
+struct trace {
+	struct trace_record records[TRACE_RECORDS];
+	uint64_t head;		/* number of records written so far */
+};
+
+/* file layout: header followed by count records, oldest first */
+#define TRACE_MAGIC "BSLTRC01"
+
+struct trace_file_header {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t count;
+	uint64_t dropped;	/* records overwritten before the dump */
+	char device[64];
+};
+
+void trace_frame(struct trace *t, uint8_t dir, uint8_t cmd,
+		const uint8_t *buf, uint32_t len, int status);
+
+int trace_write(const struct trace *t, const char *device,
+		const char *filename);
+
+const char *trace_cmd_name(uint8_t cmd);
+
+#endif /* #ifndef __TRACE_H__ */
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bsl_intf;
+
+/*
+ * A transport moves BSL frames between the host and the device. The frame
+ * buffers are owned by the caller and handed through as they are, a
+ * transport must not copy them.
+ */
+struct bsl_transport {
+	const char *name;
+
+	int (*open)(struct bsl_intf *intf, const char *device);
+	/* bring the link into the state the BSL expects after reset */
+	int (*configure)(struct bsl_intf *intf);
+	/*
+	 * Send a request and receive the acknowledgement and, if core is set,
+	 * the core response into rx. read_len is the expected response length
+	 * on entry and the received length on return.
+	 */
+	int (*write_read)(struct bsl_intf *intf, uint8_t *tx, uint32_t write_len,
+			uint8_t *rx, uint32_t rx_size, uint32_t *read_len, bool core);
+	/* optional, for links with a configurable speed */
+	int (*set_speed)(struct bsl_intf *intf, uint32_t baudrate);
+	/* optional, drop whatever is still arriving of a broken exchange */
+	void (*flush)(struct bsl_intf *intf);
+	void (*close)(struct bsl_intf *intf);
+
+	/*
+	 * Optional, send a request without waiting for the response and
+	 * collect the response later. Same semantics as write_read.
+	 */
+	int (*submit)(struct bsl_intf *intf, uint8_t *tx, uint32_t write_len);
+	int (*receive)(struct bsl_intf *intf, uint8_t *rx, uint32_t rx_size,
+			uint32_t *read_len, bool core);
+};
+
+extern const struct bsl_transport uart_transport;
+extern const struct bsl_transport i2c_transport;
+
+#endif /* #ifndef __TRANSPORT_H__ */
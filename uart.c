@@ -0,0 +1,319 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2024 Kontron Europe GmbH
+ *
+ * Author: Heiko Thiery <heiko.thiery@kontron.com>
+ * Created: May 18, 2024
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/select.h>
+
+#include "bsl.h"
+#include "common.h"
+#include "log.h"
+#include "stats.h"
+#include "transport.h"
+
+extern int verbosity;
+
+/* time the BSL may take to answer once the request is on the wire */
+#define UART_TIMEOUT_MS 500
+
+struct uart_priv {
+	struct termios old_tio;
+	/* wire time of the last request, which is still in the tx queue */
+	long tx_wire_ms;
+};
+
+static int uart_wait(int fd, bool write, long timeout_ms)
+{
+	struct timeval tv;
+	fd_set fds;
+	int n;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	if (write) {
+		n = select(fd+1, NULL, &fds, NULL, &tv);
+	} else {
+		n = select(fd+1, &fds, NULL, NULL, &tv);
+	}
+	assert(n >= -1 && n <= 1);
+
+	if (n == -1) {
+		perror("select() failed");
+		return 1;
+	} else if (n == 0) {
+		/* timeout */
+		DEBUG(0, "timeout\n");
+		return ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+static int uart_write(int fd, uint8_t *tx, uint32_t len)
+{
+	uint32_t idx = 0;
+	int rc;
+
+	while (idx < len) {
+		ssize_t cnt = write(fd, tx + idx, len - idx);
+
+		if (cnt == -1) {
+			if (errno != EAGAIN && errno != EINTR) {
+				perror("write() failed");
+				return 1;
+			}
+			if ((rc = uart_wait(fd, true, UART_TIMEOUT_MS)) != 0) {
+				return rc;
+			}
+			continue;
+		}
+		idx += cnt;
+	}
+
+	return 0;
+}
+
+/*
+ * Read exactly len bytes, anything beyond stays for the next response.
+ * timeout_ms applies until the first byte arrives.
+ */
+static int uart_read(int fd, uint8_t *rx, uint32_t len, long timeout_ms)
+{
+	uint32_t idx = 0;
+	int rc;
+
+	while (idx < len) {
+		ssize_t cnt;
+
+		if ((rc = uart_wait(fd, false, timeout_ms)) != 0) {
+			return rc;
+		}
+		timeout_ms = UART_TIMEOUT_MS;
+
+		cnt = read(fd, rx + idx, len - idx);
+		if (cnt == -1 && (errno == EAGAIN || errno == EINTR)) {
+			continue;
+		}
+		assert(cnt > 0);
+		idx += cnt;
+		DEBUG(2, "received %zd bytes\n", cnt);
+	}
+
+	return 0;
+}
+
+/* discard input until the line has been quiet for UART_QUIET_MS */
+#define UART_QUIET_MS 5
+
+static void uart_flush(struct bsl_intf *intf)
+{
+	uint8_t buf[256];
+	struct timeval tv;
+	fd_set fds;
+
+	tcflush(intf->fd, TCIFLUSH);
+
+	for (;;) {
+		FD_ZERO(&fds);
+		FD_SET(intf->fd, &fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = UART_QUIET_MS * 1000;
+
+		if (select(intf->fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+			break;
+		}
+		if (read(intf->fd, buf, sizeof(buf)) <= 0
+				&& errno != EAGAIN && errno != EINTR) {
+			break;
+		}
+	}
+}
+
+static int uart_submit(struct bsl_intf *intf, uint8_t *tx, uint32_t write_len)
+{
+	struct uart_priv *priv = intf->priv;
+	int rc;
+
+	/*
+	 * write() returns once the request is queued, a large packet at a
+	 * low baudrate is still on the wire long after that. 10 bits per
+	 * byte with start and stop bit.
+	 */
+	priv->tx_wire_ms = 0;
+	if (intf->baudrate) {
+		priv->tx_wire_ms = ((uint64_t)write_len * 10 * 1000
+				+ intf->baudrate - 1) / intf->baudrate;
+	}
+
+	rc = uart_write(intf->fd, tx, write_len);
+	if (intf->timestamps) {
+		intf->t_written = stats_now();
+	}
+
+	return rc;
+}
+
+static int uart_receive(struct bsl_intf *intf, uint8_t *rx, uint32_t rx_size,
+		uint32_t *read_len, bool core)
+{
+	struct uart_priv *priv = intf->priv;
+	long timeout_ms = UART_TIMEOUT_MS + priv->tx_wire_ms;
+	uint32_t len = 0;
+	uint32_t missing;
+	int rc;
+
+	priv->tx_wire_ms = 0;
+
+	while ((missing = bsl_response_missing(rx, len, core)) > 0) {
+		if (len + missing > rx_size) {
+			/* most likely a damaged length field */
+			log_printf("ERROR: response too long\n");
+			uart_flush(intf);
+			return EBADMSG;
+		}
+
+		if ((rc = uart_read(intf->fd, rx + len, missing, timeout_ms)) != 0) {
+			return rc;
+		}
+		timeout_ms = UART_TIMEOUT_MS;
+		if (len == 0 && intf->timestamps) {
+			intf->t_first_rx = stats_now();
+		}
+		len += missing;
+	}
+
+	*read_len = len;
+
+	return 0;
+}
+
+static int uart_write_read(struct bsl_intf *intf, uint8_t *tx, uint32_t write_len,
+		uint8_t *rx, uint32_t rx_size, uint32_t *read_len, bool core)
+{
+	int rc;
+
+	if ((rc = uart_submit(intf, tx, write_len)) != 0) {
+		return rc;
+	}
+
+	return uart_receive(intf, rx, rx_size, read_len, core);
+}
+
+static speed_t uart_speed(uint32_t baudrate)
+{
+	switch (baudrate) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 1000000: return B1000000;
+		default: return B0;
+	}
+}
+
+static int uart_set_speed(struct bsl_intf *intf, uint32_t baudrate)
+{
+	struct termios tio;
+	speed_t speed;
+
+	speed = uart_speed(baudrate);
+	if (speed == B0) {
+		log_printf("ERROR: invalid baudrate\n");
+		return EINVAL;
+	}
+
+	memset(&tio, 0, sizeof(tio));
+
+	/* 8n1, baud, local connection, enable rx, sw flow control */
+	tio.c_cflag = CS8 | CLOCAL | CREAD;
+
+	cfsetspeed(&tio, speed);
+
+	tio.c_oflag = 0;
+	tio.c_lflag = 0;
+
+	if (tcsetattr(intf->fd, TCSANOW, &tio) == -1) {
+		log_printf("ERROR: tcsetattr %s\n", strerror(errno));
+		return errno;
+	}
+
+	intf->baudrate = baudrate;
+
+	return 0;
+}
+
+static int uart_open(struct bsl_intf *intf, const char *device)
+{
+	struct uart_priv *priv;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		return ENOMEM;
+	}
+
+	if ((intf->fd = open(device, O_RDWR | O_NONBLOCK | O_NOCTTY)) < 0) {
+		free(priv);
+		return errno;
+	}
+
+	if (tcgetattr(intf->fd, &priv->old_tio) == -1) {
+		log_printf("ERROR: tcgetattr %s\n", strerror(errno));
+		close(intf->fd);
+		free(priv);
+		return EIO;
+	}
+
+	intf->priv = priv;
+
+	return 0;
+}
+
+static int uart_configure(struct bsl_intf *intf)
+{
+	tcflush(intf->fd, TCOFLUSH);
+	tcflush(intf->fd, TCIFLUSH);
+
+	/* the BSL always starts with 9600 baud */
+	return uart_set_speed(intf, 9600);
+}
+
+static void uart_close(struct bsl_intf *intf)
+{
+	struct uart_priv *priv = intf->priv;
+
+	tcsetattr(intf->fd, TCSANOW, &priv->old_tio);
+	close(intf->fd);
+	free(priv);
+	intf->priv = NULL;
+}
+
+const struct bsl_transport uart_transport = {
+	.name = "uart",
+	.open = uart_open,
+	.configure = uart_configure,
+	.write_read = uart_write_read,
+	.set_speed = uart_set_speed,
+	.flush = uart_flush,
+	.close = uart_close,
+	.submit = uart_submit,
+	.receive = uart_receive,
+};